@@ -2,6 +2,47 @@
 
 #include "nonius.h++"
 #include "any_with_traits.h"
+#include "any_collection.h"
+#include "any_algorithm.h"
+#include "any_flat_hash.h"
+#include "any_flat_map.h"
+#include "task_queue.h"
+#include "thread_pool.h"
+#include "future.h"
+#include "atomic_any.h"
+#include "signal_slots.h"
+#include "dispatcher.h"
+#include "any_of.h"
+#include "any_visit.h"
+#include "any_serialization.h"
+#include "any_archive.h"
+#include "any_format.h"
+#include "any_parse.h"
+#include "continuation.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#if __cplusplus >= 201703L
+#include <variant>
+#endif
+#include <vector>
 
 int f(int x) { return std::abs(x); }
 
@@ -15,3 +56,1378 @@ NONIUS_BENCHMARK("function<void (int)>", [](nonius::chronometer meter) {
   meter.measure([=](int i) { return p (i); });
 })
 
+
+namespace storage {
+using document = std::array<int, 16>;
+constexpr int count = 1000;
+
+template <class Any> std::vector<Any> make_documents() {
+  std::vector<Any> result;
+  for (int i = 0; i < count; ++i) {
+    document doc;
+    doc.fill((i * 7919) % count);
+    result.emplace_back(doc);
+  }
+  return result;
+}
+
+template <class Any> std::string name(const char *what) {
+  return std::string(what) + " (" + std::to_string(sizeof(Any)) + " bytes)";
+}
+
+template <class Any> void move(nonius::chronometer meter) {
+  auto v = make_documents<Any>();
+  std::vector<Any> w(v.size());
+  meter.measure([&] {
+    std::move(v.begin(), v.end(), w.begin());
+    std::move(w.begin(), w.end(), v.begin());
+  });
+}
+
+template <class Any> void sort(nonius::chronometer meter) {
+  std::vector<std::vector<Any>> inputs(meter.runs());
+  for (auto &input : inputs)
+    input = make_documents<Any>();
+  meter.measure([&](int i) { std::sort(inputs[i].begin(), inputs[i].end()); });
+}
+
+using inline_any = awt::any<any_trait::orderable, any_trait::movable>;
+using heap_any = awt::heap_any<any_trait::orderable, any_trait::movable>;
+} // namespace storage
+
+NONIUS_BENCHMARK(storage::name<storage::inline_any>("awt::any move 1000 large"),
+                 storage::move<storage::inline_any>)
+NONIUS_BENCHMARK(storage::name<storage::heap_any>("awt::heap_any move 1000 large"),
+                 storage::move<storage::heap_any>)
+NONIUS_BENCHMARK(storage::name<storage::inline_any>("awt::any sort 1000 large"),
+                 storage::sort<storage::inline_any>)
+NONIUS_BENCHMARK(storage::name<storage::heap_any>("awt::heap_any sort 1000 large"),
+                 storage::sort<storage::heap_any>)
+
+NONIUS_BENCHMARK("awt::function copy stateless", [](nonius::chronometer meter) {
+  awt::function<int(int, int)> p = std::plus<int>{};
+  awt::function<int(int, int)> q;
+  meter.measure([&](int i) {
+    q = p;
+    return q(i, i);
+  });
+})
+
+NONIUS_BENCHMARK("std::function copy stateless", [](nonius::chronometer meter) {
+  std::function<int(int, int)> p = std::plus<int>{};
+  std::function<int(int, int)> q;
+  meter.measure([&](int i) {
+    q = p;
+    return q(i, i);
+  });
+})
+
+namespace simulation {
+struct particle {
+  float x = 0, v = 1;
+  void update() { x += v; }
+};
+struct body {
+  float x = 0, y = 0, vx = 1, vy = 2;
+  void update() {
+    x += vx;
+    y += vy;
+  }
+};
+struct emitter {
+  std::array<float, 8> state{};
+  void update() { state[0] += 1; }
+};
+constexpr int count = 1000000;
+} // namespace simulation
+
+AWT_DEFINE_MEMBER_FUNCTION_CALL_TRAIT(has_update, update, void());
+
+namespace simulation {
+using any = awt::any<any_trait::movable, any_trait::has_update>;
+using collection = awt::any_collection<any_trait::has_update>;
+
+template <class Insert> void fill(Insert insert) {
+  for (int i = 0; i < count; ++i) {
+    switch (i % 3) {
+    case 0:
+      insert(particle{});
+      break;
+    case 1:
+      insert(body{});
+      break;
+    case 2:
+      insert(emitter{});
+      break;
+    }
+  }
+}
+} // namespace simulation
+
+NONIUS_BENCHMARK("std::vector<awt::any> update 1M", [](nonius::chronometer meter) {
+  std::vector<simulation::any> v;
+  v.reserve(simulation::count);
+  simulation::fill([&](auto value) { v.emplace_back(value); });
+  meter.measure([&] {
+    for (auto &value : v)
+      value.update();
+  });
+})
+
+NONIUS_BENCHMARK("awt::any_collection update 1M", [](nonius::chronometer meter) {
+  simulation::collection c;
+  simulation::fill([&](auto value) { c.insert(value); });
+  meter.measure([&] { c.for_each([](auto &value) { value.update(); }); });
+})
+
+NONIUS_BENCHMARK("awt::any_collection typed update 1M", [](nonius::chronometer meter) {
+  simulation::collection c;
+  simulation::fill([&](auto value) { c.insert(value); });
+  meter.measure([&] {
+    c.for_each<simulation::particle, simulation::body, simulation::emitter>(
+        [](auto &value) { value.update(); });
+  });
+})
+
+namespace batch {
+using any = awt::any<any_trait::movable, any_trait::copiable,
+                     any_trait::hashable, any_trait::comparable>;
+constexpr int count = 10000;
+
+std::vector<any> make_values() {
+  std::vector<any> result;
+  for (int i = 0; i < count; ++i) {
+    if (i % 1000 < 900)
+      result.emplace_back(i);
+    else
+      result.emplace_back(std::to_string(i));
+  }
+  return result;
+}
+} // namespace batch
+
+NONIUS_BENCHMARK("awt::any hash loop 10000", [](nonius::chronometer meter) {
+  auto v = batch::make_values();
+  std::vector<std::size_t> out(v.size());
+  meter.measure([&] {
+    for (std::size_t i = 0; i < v.size(); ++i)
+      out[i] = v[i].hash();
+  });
+})
+
+NONIUS_BENCHMARK("awt::batch_hash 10000", [](nonius::chronometer meter) {
+  auto v = batch::make_values();
+  std::vector<std::size_t> out(v.size());
+  meter.measure(
+      [&] { awt::batch_hash(v.data(), v.data() + v.size(), out.data()); });
+})
+
+NONIUS_BENCHMARK("awt::function call loop 10000", [](nonius::chronometer meter) {
+  int sum = 0;
+  std::vector<awt::function<void(int)>> v(batch::count,
+                                          [&sum](int x) { sum += x; });
+  meter.measure([&](int i) {
+    for (auto &f : v)
+      f(i);
+    return sum;
+  });
+})
+
+NONIUS_BENCHMARK("awt::batch_invoke 10000", [](nonius::chronometer meter) {
+  int sum = 0;
+  std::vector<awt::function<void(int)>> v(batch::count,
+                                          [&sum](int x) { sum += x; });
+  meter.measure([&](int i) {
+    awt::batch_invoke(v.data(), v.data() + v.size(), i);
+    return sum;
+  });
+})
+
+namespace sorting {
+using any =
+    awt::any<any_trait::orderable, any_trait::movable, any_trait::copiable>;
+constexpr int count = 100000;
+
+std::vector<any> make_values() {
+  std::vector<any> result;
+  unsigned seed = 17;
+  for (int i = 0; i < count; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    auto x = static_cast<int>(seed >> 8);
+    switch (i % 4) {
+    case 0:
+    case 1:
+      result.emplace_back(x);
+      break;
+    case 2:
+      result.emplace_back(x * 0.5);
+      break;
+    case 3:
+      result.emplace_back(std::to_string(x));
+      break;
+    }
+  }
+  return result;
+}
+
+template <class Sort> void run(nonius::chronometer meter, Sort sort) {
+  auto values = make_values();
+  std::vector<std::vector<any>> inputs(meter.runs(), values);
+  meter.measure([&](int i) { sort(inputs[i]); });
+}
+} // namespace sorting
+
+NONIUS_BENCHMARK("std::sort 100000 mixed", [](nonius::chronometer meter) {
+  sorting::run(meter, [](std::vector<sorting::any> &v) {
+    std::sort(v.begin(), v.end());
+  });
+})
+
+NONIUS_BENCHMARK("awt::sort 100000 mixed", [](nonius::chronometer meter) {
+  sorting::run(meter, [](std::vector<sorting::any> &v) {
+    awt::sort(v.begin(), v.end());
+  });
+})
+
+NONIUS_BENCHMARK("awt::parallel_sort 100000 mixed", [](nonius::chronometer meter) {
+  sorting::run(meter, [](std::vector<sorting::any> &v) {
+    awt::parallel_sort(v.begin(), v.end());
+  });
+})
+
+namespace hashing {
+using any = awt::any<any_trait::hashable, any_trait::comparable,
+                     any_trait::movable, any_trait::copiable>;
+constexpr int count = 100000;
+
+std::vector<any> make_keys() {
+  std::vector<any> result;
+  for (int i = 0; i < count; ++i) {
+    if (i % 2)
+      result.emplace_back(i);
+    else
+      result.emplace_back(std::to_string(i));
+  }
+  return result;
+}
+
+template <class Set> void run_insert(nonius::chronometer meter) {
+  auto keys = make_keys();
+  meter.measure([&] {
+    Set s;
+    for (auto &key : keys)
+      s.insert(key);
+    return s.size();
+  });
+}
+
+template <class Set> void run_find(nonius::chronometer meter) {
+  auto keys = make_keys();
+  Set s;
+  for (auto &key : keys)
+    s.insert(key);
+  meter.measure([&] {
+    std::size_t found = 0;
+    for (int i = 0; i < count * 2; i += 3)
+      found += s.count(any(i));
+    return found;
+  });
+}
+} // namespace hashing
+
+NONIUS_BENCHMARK("std::unordered_set<awt::any> insert 100000", [](nonius::chronometer meter) {
+  hashing::run_insert<std::unordered_set<hashing::any>>(meter);
+})
+
+NONIUS_BENCHMARK("awt::any_flat_hash_set insert 100000", [](nonius::chronometer meter) {
+  hashing::run_insert<awt::any_flat_hash_set<hashing::any>>(meter);
+})
+
+NONIUS_BENCHMARK("std::unordered_set<awt::any> find 66667", [](nonius::chronometer meter) {
+  hashing::run_find<std::unordered_set<hashing::any>>(meter);
+})
+
+NONIUS_BENCHMARK("awt::any_flat_hash_set find 66667", [](nonius::chronometer meter) {
+  hashing::run_find<awt::any_flat_hash_set<hashing::any>>(meter);
+})
+
+NONIUS_BENCHMARK("awt::any_flat_hash_set typed find 66667", [](nonius::chronometer meter) {
+  auto keys = hashing::make_keys();
+  awt::any_flat_hash_set<hashing::any> s;
+  for (auto &key : keys)
+    s.insert(key);
+  meter.measure([&] {
+    std::size_t found = 0;
+    for (int i = 0; i < hashing::count * 2; i += 3)
+      found += s.count(i);
+    return found;
+  });
+})
+
+namespace lookup {
+using any =
+    awt::any<any_trait::orderable, any_trait::movable, any_trait::copiable>;
+constexpr int count = 10000;
+
+std::vector<any> make_keys() {
+  std::vector<any> result;
+  for (int i = 0; i < count; ++i) {
+    if (i % 2)
+      result.emplace_back(i);
+    else
+      result.emplace_back(std::to_string(i));
+  }
+  return result;
+}
+
+template <class Find> void run(nonius::chronometer meter, Find find) {
+  meter.measure([&] {
+    int sum = 0;
+    for (int i = 0; i < count * 2; i += 3)
+      sum += find(i);
+    return sum;
+  });
+}
+} // namespace lookup
+
+NONIUS_BENCHMARK("std::map<awt::any> find 6667", [](nonius::chronometer meter) {
+  std::map<lookup::any, int> m;
+  for (auto &key : lookup::make_keys())
+    m.emplace(key, 1);
+  lookup::run(meter, [&](int i) {
+    auto it = m.find(lookup::any(i));
+    return it != m.end() ? it->second : 0;
+  });
+})
+
+NONIUS_BENCHMARK("awt::any_flat_map find 6667", [](nonius::chronometer meter) {
+  auto keys = lookup::make_keys();
+  awt::any_flat_map<lookup::any, int> m(keys, std::vector<int>(keys.size(), 1));
+  lookup::run(meter, [&](int i) {
+    auto value = m.find(lookup::any(i));
+    return value ? *value : 0;
+  });
+})
+
+NONIUS_BENCHMARK("awt::any_flat_map typed find 6667", [](nonius::chronometer meter) {
+  auto keys = lookup::make_keys();
+  awt::any_flat_map<lookup::any, int> m(keys, std::vector<int>(keys.size(), 1));
+  lookup::run(meter, [&](int i) {
+    auto value = m.find(i);
+    return value ? *value : 0;
+  });
+})
+
+NONIUS_BENCHMARK("std::map<awt::any> build 10000", [](nonius::chronometer meter) {
+  auto keys = lookup::make_keys();
+  meter.measure([&] {
+    std::map<lookup::any, int> m;
+    for (auto &key : keys)
+      m.emplace(key, 1);
+    return m.size();
+  });
+})
+
+NONIUS_BENCHMARK("awt::any_flat_map build 10000", [](nonius::chronometer meter) {
+  auto keys = lookup::make_keys();
+  meter.measure([&] {
+    awt::any_flat_map<lookup::any, int> m(keys, std::vector<int>(keys.size(), 1));
+    return m.size();
+  });
+})
+
+namespace queue {
+constexpr int tasks = 100000;
+
+// reference: std::deque guarded by a mutex
+class locked_queue {
+public:
+  explicit locked_queue(std::size_t) {}
+  template <class F> bool try_emplace(F &&f) {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.emplace_back(std::forward<F>(f));
+    return true;
+  }
+  bool try_pop(awt::unique_function<void()> &task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tasks.empty())
+      return false;
+    task = std::move(tasks.front());
+    tasks.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex mutex;
+  std::deque<awt::unique_function<void()>> tasks;
+};
+
+// same number of producer and consumer threads pass tasks through a queue
+template <class Queue> void run(nonius::chronometer meter, int threads) {
+  meter.measure([&] {
+    Queue q(1024);
+    std::atomic<int> done{0};
+    std::atomic<int> consumed{0};
+    std::vector<std::thread> pool;
+    auto per_producer = tasks / threads;
+    for (int t = 0; t < threads; ++t) {
+      pool.emplace_back([&] {
+        for (int i = 0; i < per_producer; ++i)
+          while (!q.try_emplace([&done] { ++done; }))
+            std::this_thread::yield();
+      });
+      pool.emplace_back([&] {
+        awt::unique_function<void()> task;
+        while (consumed < per_producer * threads) {
+          if (q.try_pop(task)) {
+            task();
+            ++consumed;
+          } else
+            std::this_thread::yield();
+        }
+      });
+    }
+    for (auto &thread : pool)
+      thread.join();
+    return done.load();
+  });
+}
+} // namespace queue
+
+NONIUS_BENCHMARK("awt::task_queue 1x1 threads", [](nonius::chronometer meter) {
+  queue::run<awt::task_queue>(meter, 1);
+})
+
+NONIUS_BENCHMARK("mutex std::deque 1x1 threads", [](nonius::chronometer meter) {
+  queue::run<queue::locked_queue>(meter, 1);
+})
+
+NONIUS_BENCHMARK("awt::task_queue 4x4 threads", [](nonius::chronometer meter) {
+  queue::run<awt::task_queue>(meter, 4);
+})
+
+NONIUS_BENCHMARK("mutex std::deque 4x4 threads", [](nonius::chronometer meter) {
+  queue::run<queue::locked_queue>(meter, 4);
+})
+
+NONIUS_BENCHMARK("awt::task_queue 16x16 threads", [](nonius::chronometer meter) {
+  queue::run<awt::task_queue>(meter, 16);
+})
+
+NONIUS_BENCHMARK("mutex std::deque 16x16 threads", [](nonius::chronometer meter) {
+  queue::run<queue::locked_queue>(meter, 16);
+})
+
+NONIUS_BENCHMARK("awt::task_queue 32x32 threads", [](nonius::chronometer meter) {
+  queue::run<awt::task_queue>(meter, 32);
+})
+
+NONIUS_BENCHMARK("mutex std::deque 32x32 threads", [](nonius::chronometer meter) {
+  queue::run<queue::locked_queue>(meter, 32);
+})
+
+namespace pool {
+constexpr int tasks = 100000;
+
+// reference: std::function tasks in a queue guarded by mutex and condvar
+class locked_pool {
+public:
+  explicit locked_pool(std::size_t threads) {
+    for (std::size_t i = 0; i < threads; ++i)
+      workers.emplace_back([this] {
+        for (;;) {
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+              return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+          }
+          task();
+        }
+      });
+  }
+  ~locked_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  template <class F> void post(F &&f) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.emplace_back(std::forward<F>(f));
+    }
+    wake.notify_one();
+  }
+
+  template <class F> std::future<std::result_of_t<F()>> submit(F f) {
+    auto task = std::make_shared<std::packaged_task<std::result_of_t<F()>()>>(
+        std::move(f));
+    auto result = task->get_future();
+    post([task] { (*task)(); });
+    return result;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<std::function<void()>> tasks;
+  std::vector<std::thread> workers;
+  bool stopping = false;
+};
+
+constexpr std::size_t threads = 4;
+
+// round trip of a single task
+template <class Pool> void run_latency(nonius::chronometer meter) {
+  Pool p(threads);
+  meter.measure([&] { return p.submit([] { return 1; }).get(); });
+}
+
+// many small tasks posted from outside, waits for all of them
+template <class Pool> void run_throughput(nonius::chronometer meter) {
+  Pool p(threads);
+  meter.measure([&] {
+    std::atomic<int> done{0};
+    for (int i = 0; i < tasks; ++i)
+      p.post([&done] { ++done; });
+    while (done.load() < tasks)
+      std::this_thread::yield();
+  });
+}
+} // namespace pool
+
+NONIUS_BENCHMARK("awt::thread_pool submit latency", [](nonius::chronometer meter) {
+  pool::run_latency<awt::thread_pool>(meter);
+})
+
+NONIUS_BENCHMARK("mutex condvar pool submit latency", [](nonius::chronometer meter) {
+  pool::run_latency<pool::locked_pool>(meter);
+})
+
+NONIUS_BENCHMARK("awt::thread_pool post 100000", [](nonius::chronometer meter) {
+  pool::run_throughput<awt::thread_pool>(meter);
+})
+
+NONIUS_BENCHMARK("mutex condvar pool post 100000", [](nonius::chronometer meter) {
+  pool::run_throughput<pool::locked_pool>(meter);
+})
+
+NONIUS_BENCHMARK("awt::thread_pool parallel_for 100000", [](nonius::chronometer meter) {
+  awt::thread_pool p(pool::threads);
+  std::vector<int> values(pool::tasks);
+  meter.measure([&] {
+    p.parallel_for(0, values.size(), [&](std::size_t i) { ++values[i]; });
+  });
+})
+
+NONIUS_BENCHMARK("awt::future 3 then", [](nonius::chronometer meter) {
+  meter.measure([] { return continuation::run_awt(); });
+})
+
+NONIUS_BENCHMARK("std::future + std::function 3 stages", [](nonius::chronometer meter) {
+  meter.measure([] { return continuation::run_std(); });
+})
+
+namespace publication {
+constexpr int reads = 100000;
+using config = awt::any<any_trait::copiable>;
+
+// reference: shared_ptr swapped under a reader-writer lock
+class locked_config {
+public:
+  explicit locked_config(int value) : current(std::make_shared<config>(value)) {}
+  template <class F> decltype(auto) read(F f) {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex);
+    return f(*current);
+  }
+  void store(int value) {
+    auto next = std::make_shared<config>(value);
+    std::lock_guard<std::shared_timed_mutex> lock(mutex);
+    current = std::move(next);
+  }
+
+private:
+  std::shared_timed_mutex mutex;
+  std::shared_ptr<config> current;
+};
+
+class atomic_config {
+public:
+  explicit atomic_config(int value) : current(value) {}
+  template <class F> decltype(auto) read(F f) { return f(*current.load()); }
+  void store(int value) { current.store(value); }
+
+private:
+  awt::atomic_shared_any<any_trait::copiable> current;
+};
+
+// readers split the reads between them while a writer keeps replacing the
+// value
+template <class Config> void run(nonius::chronometer meter, int threads) {
+  meter.measure([&] {
+    Config c(0);
+    std::atomic<bool> stop{false};
+    std::atomic<long> sum{0};
+    std::thread writer([&] {
+      for (int i = 1; !stop; ++i) {
+        c.store(i);
+        std::this_thread::yield();
+      }
+    });
+    std::vector<std::thread> readers;
+    for (int t = 0; t < threads; ++t)
+      readers.emplace_back([&] {
+        long local = 0;
+        for (int i = 0; i < reads / threads; ++i)
+          local += c.read(
+              [](const config &value) { return *awt::any_cast<int>(&value); });
+        sum += local;
+      });
+    for (auto &reader : readers)
+      reader.join();
+    stop = true;
+    writer.join();
+    return sum.load();
+  });
+}
+} // namespace publication
+
+NONIUS_BENCHMARK("awt::atomic_shared_any 1 readers", [](nonius::chronometer meter) {
+  publication::run<publication::atomic_config>(meter, 1);
+})
+
+NONIUS_BENCHMARK("shared_timed_mutex 1 readers", [](nonius::chronometer meter) {
+  publication::run<publication::locked_config>(meter, 1);
+})
+
+NONIUS_BENCHMARK("awt::atomic_shared_any 4 readers", [](nonius::chronometer meter) {
+  publication::run<publication::atomic_config>(meter, 4);
+})
+
+NONIUS_BENCHMARK("shared_timed_mutex 4 readers", [](nonius::chronometer meter) {
+  publication::run<publication::locked_config>(meter, 4);
+})
+
+NONIUS_BENCHMARK("awt::atomic_shared_any 16 readers", [](nonius::chronometer meter) {
+  publication::run<publication::atomic_config>(meter, 16);
+})
+
+NONIUS_BENCHMARK("shared_timed_mutex 16 readers", [](nonius::chronometer meter) {
+  publication::run<publication::locked_config>(meter, 16);
+})
+
+NONIUS_BENCHMARK("awt::atomic_shared_any 64 readers", [](nonius::chronometer meter) {
+  publication::run<publication::atomic_config>(meter, 64);
+})
+
+NONIUS_BENCHMARK("shared_timed_mutex 64 readers", [](nonius::chronometer meter) {
+  publication::run<publication::locked_config>(meter, 64);
+})
+
+namespace fan_out {
+using message = std::array<char, 1024>;
+constexpr int subscribers = 32;
+
+// the same message is copied to every subscriber
+template <class Any> void run(nonius::chronometer meter) {
+  Any payload = message{};
+  std::vector<Any> inboxes(subscribers);
+  meter.measure([&] {
+    for (auto &inbox : inboxes)
+      inbox = payload;
+  });
+}
+} // namespace fan_out
+
+NONIUS_BENCHMARK("awt::normal_any fan-out 32 copies", [](nonius::chronometer meter) {
+  fan_out::run<awt::normal_any>(meter);
+})
+
+NONIUS_BENCHMARK("awt::normal_shared_any fan-out 32 copies", [](nonius::chronometer meter) {
+  fan_out::run<awt::normal_shared_any>(meter);
+})
+
+namespace signals {
+struct event {
+  int value;
+};
+
+// reference: what we did before, a vector of functions called one by one
+class function_vector {
+public:
+  template <class F> void connect(F f) { slots.emplace_back(std::move(f)); }
+  void operator()(const event &e) {
+    for (auto &slot : slots)
+      slot(e);
+  }
+
+private:
+  std::vector<awt::function<void(const event &)>> slots;
+};
+
+template <class Signal> void run(nonius::chronometer meter, int slots) {
+  Signal s;
+  long sum = 0;
+  for (int i = 0; i < slots; ++i)
+    s.connect([&sum](const event &e) { sum += e.value; });
+  meter.measure([&](int i) {
+    s(event{i});
+    return sum;
+  });
+}
+} // namespace signals
+
+NONIUS_BENCHMARK("awt::signal emit 1 slots", [](nonius::chronometer meter) {
+  signals::run<awt::signal<void(const signals::event &)>>(meter, 1);
+})
+
+NONIUS_BENCHMARK("std::vector<awt::function> emit 1 slots", [](nonius::chronometer meter) {
+  signals::run<signals::function_vector>(meter, 1);
+})
+
+NONIUS_BENCHMARK("awt::signal emit 10 slots", [](nonius::chronometer meter) {
+  signals::run<awt::signal<void(const signals::event &)>>(meter, 10);
+})
+
+NONIUS_BENCHMARK("std::vector<awt::function> emit 10 slots", [](nonius::chronometer meter) {
+  signals::run<signals::function_vector>(meter, 10);
+})
+
+NONIUS_BENCHMARK("awt::signal emit 1000 slots", [](nonius::chronometer meter) {
+  signals::run<awt::signal<void(const signals::event &)>>(meter, 1000);
+})
+
+NONIUS_BENCHMARK("std::vector<awt::function> emit 1000 slots", [](nonius::chronometer meter) {
+  signals::run<signals::function_vector>(meter, 1000);
+})
+
+namespace dispatch {
+constexpr int type_count = 50;
+constexpr int message_count = 1000;
+template <int N> struct message {
+  int value;
+};
+using any = awt::any<any_trait::movable>;
+
+template <int... Ns>
+void register_handlers(awt::dispatcher<any_trait::movable> &d, long &sum,
+                       std::integer_sequence<int, Ns...>) {
+  using expand = int[];
+  (void)expand{0, (d.on<message<Ns>>([&sum](message<Ns> &m) {
+                     sum = sum * 31 + m.value + Ns;
+                   }),
+                   0)...};
+}
+
+// reference: any_cast attempts until one succeeds
+template <int N> bool try_cast(any &value, long &sum) {
+  if (auto m = awt::any_cast<message<N>>(&value)) {
+    sum = sum * 31 + m->value + N;
+    return true;
+  }
+  return false;
+}
+
+template <int... Ns>
+bool cast_chain(any &value, long &sum, std::integer_sequence<int, Ns...>) {
+  bool found = false;
+  using expand = int[];
+  (void)expand{0, (found = found || try_cast<Ns>(value, sum), 0)...};
+  return found;
+}
+
+template <int... Ns>
+std::vector<any> make_messages(std::integer_sequence<int, Ns...>) {
+  using factory = any (*)(int);
+  factory factories[] = {[](int i) { return any(message<Ns>{i}); }...};
+  std::vector<any> result;
+  for (int i = 0; i < message_count; ++i)
+    result.push_back(factories[(i * 7919) % type_count](i));
+  return result;
+}
+
+using types = std::make_integer_sequence<int, type_count>;
+} // namespace dispatch
+
+NONIUS_BENCHMARK("awt::dispatcher 1000 messages of 50 types", [](nonius::chronometer meter) {
+  auto messages = dispatch::make_messages(dispatch::types());
+  awt::dispatcher<any_trait::movable> d;
+  long sum = 0;
+  dispatch::register_handlers(d, sum, dispatch::types());
+  meter.measure([&] {
+    for (auto &m : messages)
+      d.dispatch(m);
+    return sum;
+  });
+})
+
+NONIUS_BENCHMARK("any_cast chain 1000 messages of 50 types", [](nonius::chronometer meter) {
+  auto messages = dispatch::make_messages(dispatch::types());
+  long sum = 0;
+  // kept from being computed outside of the measurement
+  volatile long result;
+  meter.measure([&] {
+    for (auto &m : messages)
+      dispatch::cast_chain(m, sum, dispatch::types());
+    result = sum;
+  });
+})
+
+namespace narrowing {
+using wide = awt::any<any_trait::copiable, any_trait::movable,
+                      any_trait::hashable, any_trait::comparable>;
+using narrow = awt::any<any_trait::movable>;
+
+std::vector<wide> make_values() {
+  std::vector<wide> result;
+  for (int i = 0; i < 1000; ++i)
+    result.push_back(std::string(64, char('a' + i % 26)));
+  return result;
+}
+} // namespace narrowing
+
+NONIUS_BENCHMARK("narrowing conversion 1000 large values", [](nonius::chronometer meter) {
+  auto values = narrowing::make_values();
+  std::vector<std::vector<narrowing::wide>> inputs(meter.runs(), values);
+  std::vector<narrowing::narrow> result(values.size());
+  meter.measure([&](int run) {
+    auto &input = inputs[run];
+    for (std::size_t i = 0; i < input.size(); ++i)
+      result[i] = std::move(input[i]);
+  });
+})
+
+NONIUS_BENCHMARK("any_cast and reconstruct 1000 large values", [](nonius::chronometer meter) {
+  auto values = narrowing::make_values();
+  std::vector<std::vector<narrowing::wide>> inputs(meter.runs(), values);
+  std::vector<narrowing::narrow> result(values.size());
+  meter.measure([&](int run) {
+    auto &input = inputs[run];
+    for (std::size_t i = 0; i < input.size(); ++i)
+      result[i] = awt::any_cast<std::string>(input[i]);
+  });
+})
+
+namespace ownership {
+// stands for a parser node built on the heap
+struct node {
+  std::array<int, 64> data;
+};
+
+template <class Store> void run(nonius::chronometer meter, Store store) {
+  std::vector<std::vector<std::unique_ptr<node>>> inputs(meter.runs());
+  for (auto &input : inputs)
+    for (int i = 0; i < 1000; ++i)
+      input.push_back(std::make_unique<node>());
+  std::vector<awt::any<any_trait::movable>> result(1000);
+  meter.measure([&](int run) {
+    auto &input = inputs[run];
+    for (std::size_t i = 0; i < input.size(); ++i)
+      store(result[i], input[i]);
+  });
+}
+} // namespace ownership
+
+NONIUS_BENCHMARK("awt::any adopt 1000 unique_ptrs", [](nonius::chronometer meter) {
+  ownership::run(meter, [](awt::any<any_trait::movable> &v,
+                           std::unique_ptr<ownership::node> &ptr) {
+    v.adopt(std::move(ptr));
+  });
+})
+
+NONIUS_BENCHMARK("awt::any move from 1000 unique_ptrs", [](nonius::chronometer meter) {
+  ownership::run(meter, [](awt::any<any_trait::movable> &v,
+                           std::unique_ptr<ownership::node> &ptr) {
+    v = std::move(*ptr);
+    ptr.reset();
+  });
+})
+
+namespace serialization {
+struct vec3 {
+  double x, y, z;
+};
+using any = awt::any<any_trait::movable, any_trait::serializable>;
+constexpr int value_count = 1000000;
+
+std::vector<any> make_values() {
+  auto &registry = awt::serialization_registry<any>::instance();
+  registry.add<int>("int");
+  registry.add<double>("double");
+  registry.add<std::string>("string");
+  registry.add<vec3>("vec3");
+  std::vector<any> result;
+  result.reserve(value_count);
+  for (int i = 0; i < value_count; ++i) {
+    switch (i % 4) {
+    case 0:
+      result.emplace_back(i);
+      break;
+    case 1:
+      result.emplace_back(i * 0.5);
+      break;
+    case 2:
+      result.emplace_back(std::string("value ") + std::to_string(i % 100));
+      break;
+    default:
+      result.emplace_back(vec3{1., 2., 3.});
+    }
+  }
+  return result;
+}
+
+// reference: writing with an any_cast attempt per known type
+template <typename T> bool try_write(const any &value, awt::writer &out) {
+  if (auto v = awt::any_cast<T>(&value)) {
+    out.write_value(awt::detail::serialization_key<T>::value);
+    auto size_offset = out.size();
+    out.write_value(std::uint32_t(0));
+    awt::serializer<T>::write(out, *v);
+    auto size = static_cast<std::uint32_t>(out.size() - size_offset - 4);
+    out.write_at(size_offset, &size, sizeof(size));
+    return true;
+  }
+  return false;
+}
+
+void write_cascade(const any &value, awt::writer &out) {
+  try_write<int>(value, out) || try_write<double>(value, out) ||
+      try_write<std::string>(value, out) || try_write<vec3>(value, out);
+}
+
+std::vector<char> buffer_for(const std::vector<any> &values) {
+  awt::writer counter(nullptr, 0);
+  for (auto &v : values)
+    v.serialize(counter);
+  return std::vector<char>(counter.size());
+}
+} // namespace serialization
+
+NONIUS_BENCHMARK("serializable trait write 1M values", [](nonius::chronometer meter) {
+  auto values = serialization::make_values();
+  auto buffer = serialization::buffer_for(values);
+  volatile std::size_t result;
+  meter.measure([&] {
+    awt::writer out(buffer.data(), buffer.size());
+    for (auto &v : values)
+      v.serialize(out);
+    result = out.size();
+  });
+})
+
+NONIUS_BENCHMARK("any_cast cascade write 1M values", [](nonius::chronometer meter) {
+  auto values = serialization::make_values();
+  auto buffer = serialization::buffer_for(values);
+  volatile std::size_t result;
+  meter.measure([&] {
+    awt::writer out(buffer.data(), buffer.size());
+    for (auto &v : values)
+      serialization::write_cascade(v, out);
+    result = out.size();
+  });
+})
+
+NONIUS_BENCHMARK("serialization registry read 1M values", [](nonius::chronometer meter) {
+  auto values = serialization::make_values();
+  auto buffer = serialization::buffer_for(values);
+  awt::writer out(buffer.data(), buffer.size());
+  for (auto &v : values)
+    v.serialize(out);
+  auto &registry =
+      awt::serialization_registry<serialization::any>::instance();
+  std::vector<serialization::any> result(values.size());
+  meter.measure([&] {
+    awt::reader in(buffer.data(), buffer.size());
+    for (auto &v : result)
+      v = registry.read(in);
+  });
+})
+
+namespace startup {
+using any = serialization::any;
+constexpr int value_count = 200000;
+const char *text_path = "awt_benchmark_config.txt";
+const char *archive_path = "awt_benchmark_config.bin";
+
+// config as "type value" lines and as an archive
+void write_files() {
+  auto &registry = awt::serialization_registry<any>::instance();
+  registry.add<int>("int");
+  registry.add<double>("double");
+  registry.add<std::string>("string");
+  std::ofstream text(text_path);
+  awt::archive_builder builder;
+  for (int i = 0; i < value_count; ++i) {
+    switch (i % 3) {
+    case 0:
+      text << "int " << i << "\n";
+      builder.add(any(i));
+      break;
+    case 1:
+      text << "double " << i * 0.5 << "\n";
+      builder.add(any(i * 0.5));
+      break;
+    default:
+      text << "string name" << i % 100 << "\n";
+      builder.add(any(std::string("name") + std::to_string(i % 100)));
+    }
+  }
+  builder.save(archive_path);
+}
+
+std::vector<any> parse_text() {
+  std::ifstream file(text_path);
+  std::string contents((std::istreambuf_iterator<char>(file)),
+                       std::istreambuf_iterator<char>());
+  std::vector<any> result;
+  result.reserve(value_count);
+  const char *p = contents.c_str();
+  while (*p) {
+    auto type_end = std::strchr(p, ' ');
+    auto line_end = std::strchr(type_end, '\n');
+    if (std::strncmp(p, "int", 3) == 0)
+      result.emplace_back(int(std::strtol(type_end + 1, nullptr, 10)));
+    else if (std::strncmp(p, "double", 6) == 0)
+      result.emplace_back(std::strtod(type_end + 1, nullptr));
+    else
+      result.emplace_back(std::string(type_end + 1, line_end));
+    p = line_end + 1;
+  }
+  return result;
+}
+} // namespace startup
+
+NONIUS_BENCHMARK("parse 200k text config values", [](nonius::chronometer meter) {
+  startup::write_files();
+  volatile std::size_t result;
+  meter.measure([&] { result = startup::parse_text().size(); });
+})
+
+NONIUS_BENCHMARK("map archive of 200k config values", [](nonius::chronometer meter) {
+  startup::write_files();
+  volatile double result;
+  meter.measure([&] {
+    awt::archive archive(startup::archive_path);
+    double sum = 0;
+    for (std::size_t i = 0; i < archive.size(); ++i) {
+      auto view = archive[i];
+      if (auto x = view.get<int>())
+        sum += *x;
+      else if (auto y = view.get<double>())
+        sum += *y;
+      else
+        sum += view.size();
+    }
+    result = sum;
+  });
+})
+
+NONIUS_BENCHMARK("materialize archive of 200k config values", [](nonius::chronometer meter) {
+  startup::write_files();
+  volatile std::size_t result;
+  meter.measure([&] {
+    awt::archive archive(startup::archive_path);
+    std::vector<startup::any> values;
+    values.reserve(archive.size());
+    for (std::size_t i = 0; i < archive.size(); ++i)
+      values.push_back(archive[i].materialize<startup::any>());
+    result = values.size();
+  });
+})
+
+namespace formatting {
+template <class Any> std::vector<Any> make_values() {
+  std::vector<Any> result;
+  for (int i = 0; i < 1000; ++i) {
+    switch (i % 3) {
+    case 0:
+      result.emplace_back(i * 7919);
+      break;
+    case 1:
+      result.emplace_back(i * 0.25);
+      break;
+    default:
+      result.emplace_back(std::string("name") + std::to_string(i % 100));
+    }
+  }
+  return result;
+}
+} // namespace formatting
+
+NONIUS_BENCHMARK("formattable format_to 1000 values", [](nonius::chronometer meter) {
+  using any = awt::any<any_trait::movable, any_trait::formattable>;
+  auto values = formatting::make_values<any>();
+  std::vector<char> buffer(64 * 1024);
+  volatile std::size_t result;
+  meter.measure([&] {
+    std::size_t size = 0;
+    for (auto &v : values) {
+      size += v.format_to(buffer.data() + size, buffer.size() - size);
+      buffer[size++] = ' ';
+    }
+    result = size;
+  });
+})
+
+NONIUS_BENCHMARK("std::stringstream << ostreamable 1000 values", [](nonius::chronometer meter) {
+  using any = awt::any<any_trait::movable, any_trait::ostreamable>;
+  auto values = formatting::make_values<any>();
+  volatile std::size_t result;
+  meter.measure([&] {
+    std::stringstream ss;
+    for (auto &v : values)
+      ss << v << ' ';
+    result = ss.str().size();
+  });
+})
+
+namespace config {
+using any = awt::any<any_trait::movable, any_trait::parsable>;
+
+struct entry {
+  const char *type;
+  std::string text;
+};
+
+// config values with their declared types
+inline std::vector<entry> make_entries() {
+  std::vector<entry> result;
+  for (int i = 0; i < 1000; ++i) {
+    switch (i % 3) {
+    case 0:
+      result.push_back({"int", std::to_string(i * 7919)});
+      break;
+    case 1:
+      result.push_back({"double", std::to_string(i * 0.25)});
+      break;
+    default:
+      result.push_back({"string", "name" + std::to_string(i % 100)});
+    }
+  }
+  return result;
+}
+
+// what the config loader did: try int, then double, then keep the text
+inline any parse_by_trial(const std::string &text) {
+  char *end;
+  errno = 0;
+  auto l = std::strtol(text.c_str(), &end, 10);
+  if (*end == '\0' && errno == 0)
+    return any(static_cast<int>(l));
+  auto d = std::strtod(text.c_str(), &end);
+  if (*end == '\0')
+    return any(d);
+  return any(text);
+}
+} // namespace config
+
+NONIUS_BENCHMARK("parse_registry parse 1000 values", [](nonius::chronometer meter) {
+  auto &registry = awt::parse_registry<config::any>::instance();
+  registry.add<int>("int");
+  registry.add<double>("double");
+  registry.add<std::string>("string");
+  auto entries = config::make_entries();
+  std::vector<std::uint64_t> keys;
+  for (auto &e : entries)
+    keys.push_back(registry.key(e.type));
+  std::vector<config::any> values(entries.size());
+  volatile bool result;
+  meter.measure([&] {
+    bool ok = true;
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+      auto &text = entries[i].text;
+      ok &= registry.parse(keys[i], text.data(), text.data() + text.size(),
+                           values[i]);
+    }
+    result = ok;
+  });
+})
+
+NONIUS_BENCHMARK("parse by trial strtol/strtod 1000 values", [](nonius::chronometer meter) {
+  auto entries = config::make_entries();
+  std::vector<config::any> values(entries.size());
+  volatile bool result;
+  meter.measure([&] {
+    for (std::size_t i = 0; i < entries.size(); ++i)
+      values[i] = config::parse_by_trial(entries[i].text);
+    result = values.back().has_value();
+  });
+})
+
+namespace candidates {
+using dispatch::any;
+using dispatch::message;
+
+// values of all candidate types, in a scattered order
+template <int... Ns>
+std::vector<any> make_values(std::integer_sequence<int, Ns...>) {
+  using factory = any (*)(int);
+  factory factories[] = {[](int i) { return any(message<Ns>{i}); }...};
+  std::vector<any> result;
+  for (int i = 0; i < dispatch::message_count; ++i)
+    result.push_back(factories[(i * 7919) % sizeof...(Ns)](i));
+  return result;
+}
+
+struct accumulate {
+  template <int N> void operator()(message<N> &m) const {
+    sum = sum * 31 + m.value + N;
+  }
+  void operator()(any &) const {}
+
+  long &sum;
+};
+
+template <int... Ns>
+void run_visit(nonius::chronometer meter, std::integer_sequence<int, Ns...> types) {
+  auto values = make_values(types);
+  long sum = 0;
+  volatile long result;
+  meter.measure([&] {
+    for (auto &v : values)
+      awt::visit<message<Ns>...>(accumulate{sum}, v);
+    result = sum;
+  });
+}
+
+template <class Types> void run_cast_chain(nonius::chronometer meter, Types types) {
+  auto values = make_values(types);
+  long sum = 0;
+  volatile long result;
+  meter.measure([&] {
+    for (auto &v : values)
+      dispatch::cast_chain(v, sum, types);
+    result = sum;
+  });
+}
+} // namespace candidates
+
+NONIUS_BENCHMARK("awt::visit 2 candidate types", [](nonius::chronometer meter) {
+  candidates::run_visit(meter, std::make_integer_sequence<int, 2>());
+})
+
+NONIUS_BENCHMARK("any_cast chain 2 candidate types", [](nonius::chronometer meter) {
+  candidates::run_cast_chain(meter, std::make_integer_sequence<int, 2>());
+})
+
+NONIUS_BENCHMARK("awt::visit 8 candidate types", [](nonius::chronometer meter) {
+  candidates::run_visit(meter, std::make_integer_sequence<int, 8>());
+})
+
+NONIUS_BENCHMARK("any_cast chain 8 candidate types", [](nonius::chronometer meter) {
+  candidates::run_cast_chain(meter, std::make_integer_sequence<int, 8>());
+})
+
+NONIUS_BENCHMARK("awt::visit 32 candidate types", [](nonius::chronometer meter) {
+  candidates::run_visit(meter, std::make_integer_sequence<int, 32>());
+})
+
+NONIUS_BENCHMARK("any_cast chain 32 candidate types", [](nonius::chronometer meter) {
+  candidates::run_cast_chain(meter, std::make_integer_sequence<int, 32>());
+})
+
+namespace closed_set {
+constexpr int value_count = 1000;
+
+using any_of = awt::any_of<awt::type_list<int, double, std::string>,
+                           any_trait::copiable, any_trait::movable,
+                           any_trait::comparable, any_trait::hashable>;
+using any = awt::any<any_trait::copiable, any_trait::movable,
+                     any_trait::comparable, any_trait::hashable>;
+
+template <class Value> std::vector<Value> make_values() {
+  std::vector<Value> result;
+  for (int i = 0; i < value_count; ++i) {
+    switch (i % 3) {
+    case 0:
+      result.push_back(Value(i));
+      break;
+    case 1:
+      result.push_back(Value(i * 0.5));
+      break;
+    default:
+      result.push_back(Value(std::string("value ") + std::to_string(i % 10)));
+    }
+  }
+  return result;
+}
+
+// hash of every value plus comparison with its neighbour
+template <class Value, class Hash>
+std::size_t hash_and_compare(const std::vector<Value> &values, Hash hash) {
+  std::size_t result = 0;
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    result += hash(values[i]);
+    result += values[i] == values[(i + 3) % values.size()];
+  }
+  return result;
+}
+
+struct weight {
+  std::size_t operator()(int x) const { return x; }
+  std::size_t operator()(double x) const { return std::size_t(x); }
+  std::size_t operator()(const std::string &x) const { return x.size(); }
+};
+} // namespace closed_set
+
+NONIUS_BENCHMARK("awt::any_of hash and compare 1000 values", [](nonius::chronometer meter) {
+  auto values = closed_set::make_values<closed_set::any_of>();
+  volatile std::size_t result;
+  meter.measure([&] {
+    result = closed_set::hash_and_compare(
+        values, [](const closed_set::any_of &v) { return v.hash(); });
+  });
+})
+
+NONIUS_BENCHMARK("awt::any hash and compare 1000 values", [](nonius::chronometer meter) {
+  auto values = closed_set::make_values<closed_set::any>();
+  volatile std::size_t result;
+  meter.measure([&] {
+    result = closed_set::hash_and_compare(
+        values, [](const closed_set::any &v) { return v.hash(); });
+  });
+})
+
+NONIUS_BENCHMARK("awt::any_of visit 1000 values", [](nonius::chronometer meter) {
+  auto values = closed_set::make_values<closed_set::any_of>();
+  volatile std::size_t result;
+  meter.measure([&] {
+    std::size_t sum = 0;
+    for (auto &v : values)
+      sum += awt::visit(closed_set::weight(), v);
+    result = sum;
+  });
+})
+
+#if __cplusplus >= 201703L
+namespace closed_set {
+using variant = std::variant<int, double, std::string>;
+} // namespace closed_set
+
+NONIUS_BENCHMARK("std::variant hash and compare 1000 values", [](nonius::chronometer meter) {
+  auto values = closed_set::make_values<closed_set::variant>();
+  volatile std::size_t result;
+  meter.measure([&] {
+    result = closed_set::hash_and_compare(values, std::hash<closed_set::variant>());
+  });
+})
+
+NONIUS_BENCHMARK("std::variant visit 1000 values", [](nonius::chronometer meter) {
+  auto values = closed_set::make_values<closed_set::variant>();
+  volatile std::size_t result;
+  meter.measure([&] {
+    std::size_t sum = 0;
+    for (auto &v : values)
+      sum += std::visit(closed_set::weight(), v);
+    result = sum;
+  });
+})
+#endif
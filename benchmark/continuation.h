@@ -0,0 +1,31 @@
+#pragma once
+
+#include "future.h"
+
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace continuation {
+// value goes through three continuations
+inline int run_awt() {
+  awt::promise<int> p;
+  auto f = p.get_future()
+               .then([](int x) { return x + 3; })
+               .then([](int x) { return x * 2; })
+               .then([](int x) { return x + 1; });
+  p.set_value(1);
+  return f.get();
+}
+
+// the same chained by hand through std::function
+inline int run_std() {
+  auto p = std::make_shared<std::promise<int>>();
+  auto f = p->get_future();
+  std::function<void(int)> last = [p](int x) { p->set_value(x + 1); };
+  std::function<void(int)> middle = [last](int x) { last(x * 2); };
+  std::function<void(int)> first = [middle](int x) { middle(x + 3); };
+  first(1);
+  return f.get();
+}
+} // namespace continuation
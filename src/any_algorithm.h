@@ -0,0 +1,367 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace awt {
+namespace detail {
+template <class... Traits> struct first_callable {
+  static_assert(sizeof...(Traits) < 0, "any has no callable trait");
+};
+template <class Signature, class... Traits>
+struct first_callable<any_trait::callable<Signature>, Traits...> {
+  using signature = Signature;
+};
+template <class Trait, class... Traits>
+struct first_callable<Trait, Traits...> : first_callable<Traits...> {};
+
+// calls f(begin, end) for every run of consecutive anys sharing func table
+template <class Any, class F>
+void for_each_f_table_run(const Any *first, std::size_t n, F f) {
+  std::size_t begin = 0;
+  while (begin < n) {
+    auto f_table = any_access::f_table(first[begin]);
+    auto end = begin + 1;
+    while (end < n && any_access::f_table(first[end]) == f_table)
+      ++end;
+    f(begin, end);
+    begin = end;
+  }
+}
+
+template <class Ret, class... ArgTypes, class... Traits, class... Args>
+void batch_invoke_impl(type_t<Ret(ArgTypes...)>,
+                       const any_t<Traits...> *first,
+                       const any_t<Traits...> *last, Args &... args) {
+  using trait = any_trait::callable<Ret(ArgTypes...)>;
+  static_assert(trait_impl<trait>::batch_invocable::value,
+                "arguments are passed to every call and have to be copiable");
+  for_each_f_table_run(first, last - first, [&](std::size_t begin,
+                                                std::size_t end) {
+    auto &head = first[begin];
+    if (!head.has_value())
+      throw std::bad_function_call{};
+    // visit_ftable is noexcept, the call itself is made outside of it
+    auto kernel = any_access::visit_ftable(head, [](auto f_table) {
+      return trait_f_table<trait>(f_table)->call_call_n;
+    });
+    kernel(any_access::storage(head), sizeof(head), end - begin, args...);
+  });
+}
+
+// range of anys holding the same type after partition_by_type
+struct type_run {
+  std::size_t begin, end;
+  // nullptr if elements in the run use different tables
+  const void *f_table;
+  // nullptr for empty anys
+  const std::type_info *type;
+};
+
+// Reorders anys so that values of the same type are adjacent, with empty
+// values first and types ordered by std::type_index, i.e. the order of
+// orderable's operator<. Single pass to find types plus a cycle permutation
+// made of swaps.
+template <class... Traits>
+std::vector<type_run> partition_by_type(any_t<Traits...> *first,
+                                        std::size_t n) {
+  struct group {
+    const void *f_table;
+    const std::type_info *type;
+    std::size_t count;
+    std::size_t offset;
+  };
+  std::vector<group> groups;
+  std::vector<std::uint32_t> group_of(n);
+  std::unordered_map<const void *, std::uint32_t> group_index;
+  std::uint32_t last = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    auto f_table = any_access::f_table(first[i]);
+    if (groups.empty() || groups[last].f_table != f_table) {
+      auto it = group_index.find(f_table);
+      if (it != group_index.end())
+        last = it->second;
+      else {
+        last = static_cast<std::uint32_t>(groups.size());
+        group_index.emplace(f_table, last);
+        groups.push_back({f_table,
+                          first[i].has_value() ? &first[i].type() : nullptr,
+                          0, 0});
+      }
+    }
+    ++groups[last].count;
+    group_of[i] = last;
+  }
+
+  std::vector<std::uint32_t> order(groups.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+    auto lhs = groups[a].type, rhs = groups[b].type;
+    if (!lhs || !rhs)
+      return !lhs && rhs;
+    return std::type_index(*lhs) < std::type_index(*rhs);
+  });
+
+  std::vector<type_run> runs;
+  std::size_t offset = 0;
+  for (auto index : order) {
+    auto &g = groups[index];
+    g.offset = offset;
+    offset += g.count;
+    if (!runs.empty() && g.type && runs.back().type &&
+        *runs.back().type == *g.type) {
+      runs.back().end = offset;
+      runs.back().f_table = nullptr;
+    } else
+      runs.push_back({g.offset, offset, g.f_table, g.type});
+  }
+
+  // position of each element after partition, then apply it in place
+  std::vector<std::size_t> target(n);
+  for (std::size_t i = 0; i < n; ++i)
+    target[i] = groups[group_of[i]].offset++;
+  for (std::size_t i = 0; i < n; ++i) {
+    while (target[i] != i) {
+      auto j = target[i];
+      first[i].swap(first[j]);
+      std::swap(target[i], target[j]);
+    }
+  }
+  return runs;
+}
+
+template <class... Traits>
+auto sort_kernel(const any_t<Traits...> &value) {
+  return any_access::visit_ftable(value, [](auto f_table) {
+    return trait_f_table<any_trait::orderable>(f_table)->call_sort_n;
+  });
+}
+
+template <class... Traits>
+auto less_than_kernel(const any_t<Traits...> &value) {
+  return any_access::visit_ftable(value, [](auto f_table) {
+    return trait_f_table<any_trait::orderable>(f_table)->call_less_than;
+  });
+}
+
+template <class... Traits>
+void sort_type_run(any_t<Traits...> *first, const type_run &run) {
+  if (!run.type || run.end - run.begin < 2)
+    return;
+  auto run_first = first + run.begin;
+  if (run.f_table) {
+    if (auto kernel = sort_kernel(*run_first))
+      return kernel(any_access::storage(*run_first), sizeof(*run_first),
+                    run.end - run.begin);
+  }
+  std::sort(run_first, first + run.end);
+}
+
+// runs f(0) ... f(count - 1) on up to given number of threads, rethrows the
+// first exception
+template <class F>
+void parallel_for_index(std::size_t threads, std::size_t count, const F &f) {
+  std::atomic<std::size_t> next{0};
+  std::exception_ptr error;
+  std::atomic_flag has_error = ATOMIC_FLAG_INIT;
+  auto worker = [&] {
+    try {
+      for (std::size_t i; (i = next++) < count;)
+        f(i);
+    } catch (...) {
+      if (!has_error.test_and_set())
+        error = std::current_exception();
+    }
+  };
+  std::vector<std::thread> pool;
+  for (std::size_t i = 1; i < std::min(threads, count); ++i)
+    pool.emplace_back(worker);
+  worker();
+  for (auto &thread : pool)
+    thread.join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+template <class... Traits>
+void parallel_sort_impl(any_t<Traits...> *first, std::size_t n,
+                        std::size_t threads) {
+  using any_type = any_t<Traits...>;
+  constexpr std::size_t min_chunk = 4096;
+  auto runs = partition_by_type(first, n);
+  auto chunk = std::max(min_chunk, n / std::max<std::size_t>(threads, 1));
+
+  // runs sorted by their kernel are split into chunks sorted independently
+  // and merged afterwards
+  struct split_run {
+    std::vector<std::size_t> bounds;
+    bool (*less)(const void *, const void *);
+  };
+  std::vector<split_run> split_runs;
+  struct piece {
+    std::size_t begin, end;
+    const type_run *whole_run;
+  };
+  std::vector<piece> pieces;
+  for (auto &run : runs) {
+    if (!run.type)
+      continue;
+    auto size = run.end - run.begin;
+    if (size <= chunk || !run.f_table || !sort_kernel(first[run.begin])) {
+      pieces.push_back({run.begin, run.end, &run});
+      continue;
+    }
+    split_run split{{}, less_than_kernel(first[run.begin])};
+    for (auto begin = run.begin; begin < run.end; begin += chunk) {
+      split.bounds.push_back(begin);
+      pieces.push_back({begin, std::min(begin + chunk, run.end), nullptr});
+    }
+    split.bounds.push_back(run.end);
+    split_runs.push_back(std::move(split));
+  }
+
+  parallel_for_index(threads, pieces.size(), [&](std::size_t i) {
+    auto &p = pieces[i];
+    if (p.whole_run)
+      return sort_type_run(first, *p.whole_run);
+    auto kernel = sort_kernel(first[p.begin]);
+    kernel(any_access::storage(first[p.begin]), sizeof(any_type),
+           p.end - p.begin);
+  });
+
+  struct merge_task {
+    std::size_t begin, middle, end;
+    bool (*less)(const void *, const void *);
+  };
+  while (true) {
+    std::vector<merge_task> tasks;
+    for (auto &split : split_runs) {
+      auto &bounds = split.bounds;
+      if (bounds.size() <= 2)
+        continue;
+      std::vector<std::size_t> merged_bounds;
+      std::size_t i = 0;
+      for (; i + 2 < bounds.size(); i += 2) {
+        tasks.push_back({bounds[i], bounds[i + 1], bounds[i + 2], split.less});
+        merged_bounds.push_back(bounds[i]);
+      }
+      for (; i < bounds.size(); ++i)
+        merged_bounds.push_back(bounds[i]);
+      bounds = std::move(merged_bounds);
+    }
+    if (tasks.empty())
+      break;
+    parallel_for_index(threads, tasks.size(), [&](std::size_t i) {
+      auto &task = tasks[i];
+      std::inplace_merge(first + task.begin, first + task.middle,
+                         first + task.end,
+                         [&](const any_type &lhs, const any_type &rhs) {
+                           return task.less(any_access::data_ptr(lhs),
+                                            any_access::data_ptr(rhs));
+                         });
+    });
+  }
+}
+} // namespace detail
+
+// Batch versions of trait operations over contiguous arrays of anys.
+// Consecutive elements sharing a func table are handed to a single typed
+// kernel, so e.g. hashing a run of ints is a plain loop over them.
+
+// out[i] = first[i].hash()
+template <class... Traits>
+void batch_hash(const detail::any_t<Traits...> *first,
+                const detail::any_t<Traits...> *last, std::size_t *out) {
+  detail::for_each_f_table_run(first, last - first, [&](std::size_t begin,
+                                                        std::size_t end) {
+    auto &head = first[begin];
+    auto first_out = out + begin, last_out = out + end;
+    if (!head.has_value()) {
+      std::fill(first_out, last_out, std::size_t{7927u});
+      return;
+    }
+    auto kernel = detail::any_access::visit_ftable(head, [](auto f_table) {
+      return detail::trait_f_table<any_trait::hashable>(f_table)->call_hash_n;
+    });
+    kernel(detail::any_access::storage(head), sizeof(head), end - begin,
+           first_out);
+    // same as detail::hash_combine with type_index
+    auto type_hash = std::hash<std::type_index>()(head.type());
+    for (auto it = first_out; it != last_out; ++it)
+      *it ^= type_hash + 0x9e3779b9 + (*it << 6) + (*it >> 2);
+  });
+}
+
+// out[i] = first[i] == other_first[i]
+template <class... Traits>
+void batch_equal(const detail::any_t<Traits...> *first,
+                 const detail::any_t<Traits...> *last,
+                 const detail::any_t<Traits...> *other_first, bool *out) {
+  using detail::any_access;
+  std::size_t n = last - first;
+  std::size_t begin = 0;
+  while (begin < n) {
+    auto f_table = any_access::f_table(first[begin]);
+    if (f_table == nullptr || any_access::f_table(other_first[begin]) != f_table) {
+      // different types, only a pair of empty anys is equal
+      out[begin] = first[begin] == other_first[begin];
+      ++begin;
+      continue;
+    }
+    auto end = begin + 1;
+    while (end < n && any_access::f_table(first[end]) == f_table &&
+           any_access::f_table(other_first[end]) == f_table)
+      ++end;
+    auto kernel = any_access::visit_ftable(first[begin], [](auto f_table) {
+      return detail::trait_f_table<any_trait::comparable>(f_table)
+          ->call_equal_to_n;
+    });
+    kernel(any_access::storage(first[begin]), sizeof(*first),
+           any_access::storage(other_first[begin]), sizeof(*other_first),
+           end - begin, out + begin);
+    begin = end;
+  }
+}
+
+// calls every element of the range with the same arguments, results are
+// discarded. Throws std::bad_function_call on empty elements.
+template <class... Traits, class... Args>
+void batch_invoke(const detail::any_t<Traits...> *first,
+                  const detail::any_t<Traits...> *last, Args &&... args) {
+  using signature = typename detail::first_callable<Traits...>::signature;
+  detail::batch_invoke_impl(detail::type_t<signature>(), first, last, args...);
+}
+
+// Sorts contiguous range (array, std::vector) of orderable anys in the order
+// of operator<. Values are first grouped by type, then every type run is
+// sorted by a typed kernel, so comparisons are not dispatched.
+template <class RandomIt> void sort(RandomIt first, RandomIt last) {
+  if (last - first < 2)
+    return;
+  auto data = std::addressof(*first);
+  for (auto &run : detail::partition_by_type(data, last - first))
+    detail::sort_type_run(data, run);
+}
+
+// Same as sort, type runs are sorted in chunks on several threads and then
+// merged.
+template <class RandomIt>
+void parallel_sort(
+    RandomIt first, RandomIt last,
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+  if (last - first < 2)
+    return;
+  detail::parallel_sort_impl(std::addressof(*first), last - first, threads);
+}
+} // namespace awt
@@ -0,0 +1,328 @@
+#pragma once
+
+#include "any_serialization.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#define AWT_DETAIL_DEFINED_NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#define AWT_DETAIL_DEFINED_WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#ifdef AWT_DETAIL_DEFINED_NOMINMAX
+#undef NOMINMAX
+#undef AWT_DETAIL_DEFINED_NOMINMAX
+#endif
+#ifdef AWT_DETAIL_DEFINED_WIN32_LEAN_AND_MEAN
+#undef WIN32_LEAN_AND_MEAN
+#undef AWT_DETAIL_DEFINED_WIN32_LEAN_AND_MEAN
+#endif
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace awt {
+namespace detail {
+// Archive layout, native byte order:
+//   header  { magic, value count }
+//   entries { type key, payload offset, payload size } per value
+//   records as written by any_trait::serializable, placed so that payloads
+//   start at multiples of archive_alignment from the beginning of the file
+constexpr char archive_magic[8] = {'a', 'w', 't', 'a', 'r', 'c', 'h', '1'};
+constexpr std::size_t archive_alignment = 16;
+constexpr std::size_t record_header_size =
+    sizeof(std::uint64_t) + sizeof(std::uint32_t);
+
+struct archive_header {
+  char magic[8];
+  std::uint64_t count;
+};
+
+struct archive_entry {
+  std::uint64_t key;
+  std::uint64_t offset;
+  std::uint32_t size;
+  std::uint32_t reserved;
+};
+
+inline std::size_t align_archive_offset(std::size_t offset) {
+  return (offset + archive_alignment - 1) / archive_alignment *
+         archive_alignment;
+}
+
+// read only mapping of a whole file
+class mapped_file {
+public:
+  explicit mapped_file(const char *path) {
+#ifdef _WIN32
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      throw serialization_error(std::string("cannot open ") + path);
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+      close();
+      throw serialization_error(std::string("cannot read size of ") + path);
+    }
+    length = static_cast<std::size_t>(file_size.QuadPart);
+    if (length == 0)
+      return;
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+      data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+      close();
+      throw serialization_error(std::string("cannot map ") + path);
+    }
+#else
+    auto fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      throw serialization_error(std::string("cannot open ") + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw serialization_error(std::string("cannot read size of ") + path);
+    }
+    length = static_cast<std::size_t>(st.st_size);
+    if (length > 0) {
+      data = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+        data = nullptr;
+    }
+    ::close(fd);
+    if (length > 0 && !data)
+      throw serialization_error(std::string("cannot map ") + path);
+#endif
+  }
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+  ~mapped_file() { close(); }
+
+  const void *get() const { return data; }
+  std::size_t size() const { return length; }
+
+private:
+  void close() {
+#ifdef _WIN32
+    if (data)
+      UnmapViewOfFile(data);
+    if (mapping)
+      CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+      CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+#else
+    if (data)
+      ::munmap(data, length);
+#endif
+    data = nullptr;
+  }
+
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#endif
+  void *data = nullptr;
+  std::size_t length = 0;
+};
+} // namespace detail
+
+// Value stored in an archive, refers to the archive's memory. Trivially
+// copyable values are read in place, others are deserialized on request.
+class any_view {
+public:
+  any_view() = default;
+
+  bool has_value() const { return type_key != 0; }
+  std::uint64_t key() const { return type_key; }
+  // serialized value, aligned to detail::archive_alignment
+  const void *data() const { return payload; }
+  std::size_t size() const { return payload_size; }
+
+  template <typename T> bool is() const {
+    return has_value() && type_key == detail::serialization_key<T>::value;
+  }
+
+  // value in place, nullptr if it isn't a T
+  template <typename T> const T *get() const {
+    static_assert(detail::is_raw_serialized<T>::value,
+                  "only trivially copyable values are stored as they are");
+    static_assert(alignof(T) <= detail::archive_alignment,
+                  "type is aligned more strictly than archive values");
+    if (!is<T>() || payload_size != sizeof(T))
+      return nullptr;
+    return static_cast<const T *>(payload);
+  }
+
+  // throws std::bad_cast if it isn't a T
+  template <typename T> T load() const {
+    if (!is<T>())
+      throw std::bad_cast{};
+    reader in(payload, payload_size);
+    return serializer<T>::read(in);
+  }
+
+  // owning any through the registry of Any
+  template <class Any> Any materialize() const {
+    if (!has_value())
+      return Any();
+    auto record = static_cast<const char *>(payload) -
+                  detail::record_header_size;
+    reader in(record, detail::record_header_size + payload_size);
+    return serialization_registry<Any>::instance().read(in);
+  }
+
+private:
+  any_view(std::uint64_t type_key, const void *payload, std::size_t size)
+      : type_key(type_key), payload(payload), payload_size(size) {}
+
+  std::uint64_t type_key = 0;
+  const void *payload = nullptr;
+  std::size_t payload_size = 0;
+
+  friend class archive;
+};
+
+// Builds an archive in memory, values need any_trait::serializable
+class archive_builder {
+public:
+  template <class Any> void add(const Any &value) {
+    // record header goes right before the aligned payload
+    auto record = detail::align_archive_offset(used +
+                                               detail::record_header_size) -
+                  detail::record_header_size;
+    if (records.size() < record)
+      records.resize(2 * record);
+    for (;;) {
+      writer out(records.data() + record, records.size() - record);
+      value.serialize(out);
+      if (!out.overflow()) {
+        used = record + out.size();
+        break;
+      }
+      records.resize((std::max)(record + out.size(), 2 * records.size()));
+    }
+    detail::archive_entry entry = {};
+    std::memcpy(&entry.key, records.data() + record, sizeof(entry.key));
+    std::memcpy(&entry.size, records.data() + record + sizeof(entry.key),
+                sizeof(entry.size));
+    entry.offset = record + detail::record_header_size;
+    entries.push_back(entry);
+  }
+
+  std::size_t size() const { return entries.size(); }
+
+  // whole archive
+  std::vector<char> data() const {
+    detail::archive_header header = {};
+    std::memcpy(header.magic, detail::archive_magic, sizeof(header.magic));
+    header.count = entries.size();
+    auto records_offset = records_start();
+    std::vector<char> result(records_offset + used);
+    std::memcpy(result.data(), &header, sizeof(header));
+    auto out = result.data() + sizeof(header);
+    for (auto entry : entries) {
+      entry.offset += records_offset;
+      std::memcpy(out, &entry, sizeof(entry));
+      out += sizeof(entry);
+    }
+    if (used > 0)
+      std::memcpy(result.data() + records_offset, records.data(), used);
+    return result;
+  }
+
+  void save(const char *path) const {
+    auto bytes = data();
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    file.close();
+    if (!file)
+      throw serialization_error(std::string("cannot write ") + path);
+  }
+
+private:
+  std::size_t records_start() const {
+    return detail::align_archive_offset(sizeof(detail::archive_header) +
+                                        entries.size() *
+                                            sizeof(detail::archive_entry));
+  }
+
+  std::vector<detail::archive_entry> entries;
+  std::vector<char> records = std::vector<char>(1024);
+  std::size_t used = 0;
+};
+
+// Read only archive, either mapped from a file or over memory owned by the
+// caller. Nothing is copied or deserialized on opening except for checks of
+// the entries.
+class archive {
+public:
+  explicit archive(const char *path)
+      : file(new detail::mapped_file(path)) {
+    open(file->get(), file->size());
+  }
+
+  // data should be aligned to detail::archive_alignment and outlive archive
+  archive(const void *data, std::size_t size) { open(data, size); }
+
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  any_view operator[](std::size_t i) const {
+    detail::archive_entry entry;
+    std::memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+    return {entry.key, base + entry.offset, entry.size};
+  }
+
+private:
+  void open(const void *data, std::size_t size) {
+    base = static_cast<const char *>(data);
+    if (reinterpret_cast<std::uintptr_t>(base) % detail::archive_alignment)
+      throw serialization_error("archive data is not aligned");
+    detail::archive_header header;
+    if (size < sizeof(header))
+      throw serialization_error("archive is truncated");
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, detail::archive_magic,
+                    sizeof(header.magic)) != 0)
+      throw serialization_error("not an archive");
+    if (header.count >
+        (size - sizeof(header)) / sizeof(detail::archive_entry))
+      throw serialization_error("archive is truncated");
+    count = static_cast<std::size_t>(header.count);
+    entries = base + sizeof(header);
+    for (std::size_t i = 0; i < count; ++i) {
+      detail::archive_entry entry;
+      std::memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+      if (entry.offset < detail::record_header_size ||
+          entry.offset % detail::archive_alignment != 0 ||
+          entry.offset > size || entry.size > size - entry.offset)
+        throw serialization_error("archive entry is out of bounds");
+    }
+  }
+
+  std::unique_ptr<detail::mapped_file> file;
+  const char *base = nullptr;
+  const char *entries = nullptr;
+  std::size_t count = 0;
+};
+} // namespace awt
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <memory>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+namespace awt {
+namespace detail {
+// contiguous storage for values of a single type, values are kept in a
+// std::vector<T> hidden behind a void pointer
+template <class... Traits> class any_segment {
+public:
+  using f_table_t = func_table<any_stored_value_type::small, Traits...>;
+
+  template <typename T> static any_segment make() {
+    return any_segment(&func_table_instance<T, any_stored_value_type::small,
+                                            Traits...>::value,
+                       &segment_ops_instance<T>::value,
+                       new std::vector<T>());
+  }
+
+  const std::type_info &type() const { return *f_table->t_info; }
+  std::size_t size() const { return count; }
+
+  template <typename T> std::vector<T> &values() {
+    return *static_cast<std::vector<T> *>(storage.get());
+  }
+
+  template <typename T> const std::vector<T> &values() const {
+    return *static_cast<const std::vector<T> *>(storage.get());
+  }
+
+  // has to be called after every modification of values()
+  void update() {
+    first = static_cast<char *>(ops->data(storage.get()));
+    count = ops->size(storage.get());
+  }
+
+  void clear() {
+    ops->clear(storage.get());
+    update();
+  }
+
+  template <class F> void for_each(F &f) const {
+    auto stride = ops->stride;
+    for (auto it = first, last = first + count * stride; it != last;
+         it += stride) {
+      any_ref_t<Traits...> ref(f_table, it);
+      f(ref);
+    }
+  }
+
+private:
+  struct segment_ops {
+    void *(*data)(void *);
+    std::size_t (*size)(const void *);
+    void (*clear)(void *);
+    void (*destroy)(void *);
+    std::size_t stride;
+
+    template <typename T> static void *data_impl(void *values) {
+      return static_cast<std::vector<T> *>(values)->data();
+    }
+    template <typename T> static std::size_t size_impl(const void *values) {
+      return static_cast<const std::vector<T> *>(values)->size();
+    }
+    template <typename T> static void clear_impl(void *values) {
+      static_cast<std::vector<T> *>(values)->clear();
+    }
+    template <typename T> static void destroy_impl(void *values) {
+      delete static_cast<std::vector<T> *>(values);
+    }
+
+    template <typename T>
+    constexpr segment_ops(type_t<T>)
+        : data(&data_impl<T>), size(&size_impl<T>), clear(&clear_impl<T>),
+          destroy(&destroy_impl<T>), stride(sizeof(T)) {}
+  };
+
+  template <typename T> struct segment_ops_instance {
+    static constexpr segment_ops value = {type_t<T>()};
+  };
+
+  any_segment(const f_table_t *f_table, const segment_ops *ops, void *values)
+      : f_table(f_table), ops(ops), storage(values, ops->destroy) {}
+
+  const f_table_t *f_table;
+  const segment_ops *ops;
+  std::unique_ptr<void, void (*)(void *)> storage;
+  char *first = nullptr;
+  std::size_t count = 0;
+};
+
+template <class... Traits>
+template <typename T>
+constexpr typename any_segment<Traits...>::segment_ops
+    any_segment<Traits...>::segment_ops_instance<T>::value;
+
+template <class... Traits> class any_collection_t {
+  using segment_t = any_segment<Traits...>;
+
+public:
+  using reference = any_ref_t<Traits...>;
+
+  template <typename Type> std::decay_t<Type> &insert(Type &&value) {
+    return emplace<std::decay_t<Type>>(std::forward<Type>(value));
+  }
+
+  template <typename T, class... Args> T &emplace(Args &&... args) {
+    auto &segment = get_or_create_segment<T>();
+    auto &values = segment.template values<T>();
+    values.emplace_back(std::forward<Args>(args)...);
+    segment.update();
+    ++total_size;
+    return values.back();
+  }
+
+  std::size_t size() const { return total_size; }
+  bool empty() const { return total_size == 0; }
+
+  template <typename T> std::size_t size() const {
+    auto segment = find_segment<T>();
+    return segment ? segment->size() : 0;
+  }
+
+  template <typename T> T *begin() {
+    auto segment = find_segment<T>();
+    return segment ? segment->template values<T>().data() : nullptr;
+  }
+
+  template <typename T> T *end() { return begin<T>() + size<T>(); }
+
+  template <typename T> const T *begin() const {
+    auto segment = find_segment<T>();
+    return segment ? segment->template values<T>().data() : nullptr;
+  }
+
+  template <typename T> const T *end() const {
+    return begin<T>() + size<T>();
+  }
+
+  void clear() {
+    for (auto &segment : segments)
+      segment.clear();
+    total_size = 0;
+  }
+
+  // visits every element through its func table, table lookup happens once
+  // per segment
+  template <class F> void for_each(F &&f) {
+    for (auto &segment : segments)
+      segment.for_each(f);
+  }
+
+  // visits only elements of listed types, calls are resolved statically
+  template <class T0, class... Ts, class F> void for_each(F &&f) {
+    for_each_typed<T0, Ts...>(f);
+  }
+
+private:
+  template <class... Ts, class F> void for_each_typed(F &f) {
+    using expand = int[];
+    (void)expand{0, (for_each_of_type<Ts>(f), 0)...};
+  }
+
+  template <typename T, class F> void for_each_of_type(F &f) {
+    auto segment = find_segment<T>();
+    if (!segment)
+      return;
+    for (auto &value : segment->template values<T>())
+      f(value);
+  }
+
+  template <typename T> const segment_t *find_segment() const {
+    auto it = segment_index.find(typeid(T));
+    if (it == segment_index.end())
+      return nullptr;
+    return &segments[it->second];
+  }
+
+  template <typename T> segment_t *find_segment() {
+    return const_cast<segment_t *>(
+        static_cast<const any_collection_t *>(this)->find_segment<T>());
+  }
+
+  template <typename T> segment_t &get_or_create_segment() {
+    auto it = segment_index.find(typeid(T));
+    if (it != segment_index.end())
+      return segments[it->second];
+    segment_index.emplace(typeid(T), segments.size());
+    segments.push_back(segment_t::template make<T>());
+    return segments.back();
+  }
+
+  std::vector<segment_t> segments;
+  std::unordered_map<std::type_index, std::size_t> segment_index;
+  std::size_t total_size = 0;
+};
+} // namespace detail
+
+// stores values in contiguous per type segments, iteration goes segment by
+// segment
+template <class... Traits>
+using any_collection =
+    detail::any_collection_t<any_trait::destructible, Traits...>;
+} // namespace awt
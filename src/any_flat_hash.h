@@ -0,0 +1,568 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define AWT_DETAIL_FLAT_HASH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace awt {
+namespace detail {
+namespace flat_hash {
+// control byte of a slot: empty, deleted or 7 low bits of hash for full slots
+using ctrl_t = std::int8_t;
+constexpr ctrl_t ctrl_empty = -128;
+constexpr ctrl_t ctrl_deleted = -2;
+constexpr std::size_t group_width = 16;
+constexpr std::size_t min_capacity = group_width;
+
+inline bool is_full(ctrl_t ctrl) { return ctrl >= 0; }
+
+inline unsigned trailing_zeros(std::uint32_t mask) {
+#if defined(__GNUC__)
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#else
+  unsigned result = 0;
+  while ((mask & 1u) == 0) {
+    mask >>= 1;
+    ++result;
+  }
+  return result;
+#endif
+}
+
+// control bytes of group_width consecutive slots
+class group {
+public:
+  explicit group(const ctrl_t *pos) {
+#ifdef AWT_DETAIL_FLAT_HASH_SSE2
+    ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+#else
+    std::memcpy(ctrl, pos, group_width);
+#endif
+  }
+
+  // bit i is set if slot i has given control byte
+  std::uint32_t match(ctrl_t value) const {
+#ifdef AWT_DETAIL_FLAT_HASH_SSE2
+    return static_cast<std::uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(value), ctrl)));
+#else
+    std::uint32_t result = 0;
+    for (std::size_t i = 0; i < group_width; ++i)
+      if (ctrl[i] == value)
+        result |= 1u << i;
+    return result;
+#endif
+  }
+
+  std::uint32_t match_empty() const { return match(ctrl_empty); }
+
+  std::uint32_t match_empty_or_deleted() const {
+#ifdef AWT_DETAIL_FLAT_HASH_SSE2
+    return static_cast<std::uint32_t>(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl)));
+#else
+    std::uint32_t result = 0;
+    for (std::size_t i = 0; i < group_width; ++i)
+      if (ctrl[i] < -1)
+        result |= 1u << i;
+    return result;
+#endif
+  }
+
+private:
+#ifdef AWT_DETAIL_FLAT_HASH_SSE2
+  __m128i ctrl;
+#else
+  ctrl_t ctrl[group_width];
+#endif
+};
+
+// spreads bits of user hash, std::hash of integers is usually identity
+inline std::size_t mix(std::size_t hash) {
+  auto value = static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+  return static_cast<std::size_t>(value ^ (value >> 32));
+}
+
+// same value as any::hash() would give for any holding value
+template <typename T> std::size_t hash_as_any(const T &value) {
+  std::size_t result = std::hash<T>()(value);
+  hash_combine(result, std::type_index(typeid(T)));
+  return result;
+}
+
+struct set_policy {
+  template <class Slot> static const Slot &key(const Slot &slot) {
+    return slot;
+  }
+};
+
+struct map_policy {
+  template <class Slot> static const auto &key(const Slot &slot) {
+    return slot.first;
+  }
+};
+} // namespace flat_hash
+
+// Open addressing table of anys. Every slot remembers hash and type of its
+// key, so lookups reject mismatches without dispatching and rehash never
+// calls any::hash() again.
+template <class Key, class Slot, class Policy> class any_flat_hash_table {
+  using ctrl_t = flat_hash::ctrl_t;
+
+public:
+  using key_type = Key;
+  using value_type = Slot;
+  using size_type = std::size_t;
+
+  template <class TableType, class ValueType> class iterator_t {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::remove_const_t<ValueType>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = ValueType *;
+    using reference = ValueType &;
+
+    iterator_t() = default;
+    // iterator to const from iterator
+    template <class OtherTable, class OtherValue>
+    iterator_t(const iterator_t<OtherTable, OtherValue> &other)
+        : table(other.table), index(other.index) {}
+
+    reference operator*() const { return table->slots[index]; }
+    pointer operator->() const { return &table->slots[index]; }
+    iterator_t &operator++() {
+      index = table->next_full(index + 1);
+      return *this;
+    }
+    iterator_t operator++(int) {
+      auto result = *this;
+      ++*this;
+      return result;
+    }
+    friend bool operator==(const iterator_t &lhs, const iterator_t &rhs) {
+      return lhs.index == rhs.index;
+    }
+    friend bool operator!=(const iterator_t &lhs, const iterator_t &rhs) {
+      return lhs.index != rhs.index;
+    }
+
+  private:
+    iterator_t(TableType *table, std::size_t index)
+        : table(table), index(index) {}
+
+    TableType *table = nullptr;
+    std::size_t index = 0;
+
+    friend class any_flat_hash_table;
+    template <class, class> friend class iterator_t;
+  };
+
+  using iterator = iterator_t<any_flat_hash_table, Slot>;
+  using const_iterator = iterator_t<const any_flat_hash_table, const Slot>;
+
+  any_flat_hash_table() = default;
+  any_flat_hash_table(const any_flat_hash_table &other) { *this = other; }
+  any_flat_hash_table(any_flat_hash_table &&other) noexcept { swap(other); }
+  any_flat_hash_table &operator=(const any_flat_hash_table &other) {
+    if (this == &other)
+      return *this;
+    clear();
+    reserve(other.size());
+    for (std::size_t i = 0; i < other.capacity; ++i)
+      if (flat_hash::is_full(other.ctrl[i]))
+        insert_unique(other.hashes[i], other.types[i], other.slots[i]);
+    return *this;
+  }
+  any_flat_hash_table &operator=(any_flat_hash_table &&other) noexcept {
+    any_flat_hash_table(std::move(other)).swap(*this);
+    return *this;
+  }
+  ~any_flat_hash_table() {
+    destroy_slots();
+    deallocate();
+  }
+
+  void swap(any_flat_hash_table &other) noexcept {
+    using std::swap;
+    swap(ctrl, other.ctrl);
+    swap(slots, other.slots);
+    swap(hashes, other.hashes);
+    swap(types, other.types);
+    swap(capacity, other.capacity);
+    swap(count, other.count);
+    swap(growth_left, other.growth_left);
+  }
+
+  iterator begin() { return {this, next_full(0)}; }
+  iterator end() { return {this, capacity}; }
+  const_iterator begin() const { return {this, next_full(0)}; }
+  const_iterator end() const { return {this, capacity}; }
+
+  size_type size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  void clear() {
+    destroy_slots();
+    if (capacity) {
+      std::fill(ctrl, ctrl + capacity + flat_hash::group_width,
+                flat_hash::ctrl_empty);
+      growth_left = max_load(capacity);
+    }
+    count = 0;
+  }
+
+  void reserve(size_type n) {
+    auto required = flat_hash::min_capacity;
+    while (max_load(required) < n)
+      required *= 2;
+    if (required > capacity)
+      rehash(required);
+  }
+
+  iterator find(const Key &key) {
+    return {this, find_index(hash_of(key), key_type_of(key), key_equal(key))};
+  }
+  const_iterator find(const Key &key) const {
+    return {this, find_index(hash_of(key), key_type_of(key), key_equal(key))};
+  }
+
+  // lookup by concrete value, no any is constructed
+  template <typename T, class = std::enable_if_t<
+                            !std::is_same<std::decay_t<T>, Key>::value>>
+  iterator find(const T &key) {
+    return {this, find_index(flat_hash::hash_as_any(key), &typeid(T),
+                             typed_equal(key))};
+  }
+  template <typename T, class = std::enable_if_t<
+                            !std::is_same<std::decay_t<T>, Key>::value>>
+  const_iterator find(const T &key) const {
+    return {this, find_index(flat_hash::hash_as_any(key), &typeid(T),
+                             typed_equal(key))};
+  }
+
+  iterator erase(const_iterator pos) {
+    erase_index(pos.index);
+    return {this, next_full(pos.index + 1)};
+  }
+
+protected:
+  template <typename T> size_type count_key(const T &key) const {
+    return find(key) != end() ? 1 : 0;
+  }
+
+  template <typename T> size_type erase_key(const T &key) {
+    auto it = find(key);
+    if (it == end())
+      return 0;
+    erase_index(it.index);
+    return 1;
+  }
+
+  // finds key or constructs slot from args if it is missing
+  template <class Equal, class... Args>
+  std::pair<iterator, bool> find_or_emplace(std::size_t hash,
+                                            const std::type_info *type,
+                                            const Equal &equal,
+                                            Args &&... args) {
+    auto index = find_index(hash, type, equal);
+    if (index != capacity)
+      return {{this, index}, false};
+    index = insert_unique(hash, type, std::forward<Args>(args)...);
+    return {{this, index}, true};
+  }
+
+  static std::size_t hash_of(const Key &key) { return key.hash(); }
+
+  static const std::type_info *key_type_of(const Key &key) {
+    return key.has_value() ? &key.type() : nullptr;
+  }
+
+  static auto key_equal(const Key &key) {
+    return [&key](const Key &other) {
+      if (!key.has_value())
+        return true; // types are already equal
+      auto equal_to = any_access::visit_ftable(key, [](auto f_table) {
+        return trait_f_table<any_trait::comparable>(f_table)->call_equal_to;
+      });
+      return equal_to(any_access::data_ptr(key), any_access::data_ptr(other));
+    };
+  }
+
+  template <typename T> static auto typed_equal(const T &key) {
+    return [&key](const Key &other) {
+      return *static_cast<const T *>(any_access::data_ptr(other)) == key;
+    };
+  }
+
+private:
+  static std::size_t max_load(std::size_t capacity) {
+    return capacity - capacity / 8;
+  }
+
+  static bool same_type(const std::type_info *lhs, const std::type_info *rhs) {
+    // type_info objects are not guaranteed to be unique across modules
+    return lhs == rhs || (lhs && rhs && *lhs == *rhs);
+  }
+
+  std::size_t next_full(std::size_t index) const {
+    while (index < capacity && !flat_hash::is_full(ctrl[index]))
+      ++index;
+    return index;
+  }
+
+  template <class Equal>
+  std::size_t find_index(std::size_t hash, const std::type_info *type,
+                         const Equal &equal) const {
+    if (capacity == 0)
+      return capacity;
+    auto mixed = flat_hash::mix(hash);
+    auto h2 = static_cast<ctrl_t>(mixed & 0x7f);
+    auto mask = capacity - 1;
+    auto offset = (mixed >> 7) & mask;
+    for (std::size_t step = 0;;) {
+      flat_hash::group g(ctrl + offset);
+      for (auto bits = g.match(h2); bits; bits &= bits - 1) {
+        auto index = (offset + flat_hash::trailing_zeros(bits)) & mask;
+        if (hashes[index] == hash && same_type(types[index], type) &&
+            equal(Policy::key(slots[index])))
+          return index;
+      }
+      if (g.match_empty())
+        return capacity;
+      step += flat_hash::group_width;
+      offset = (offset + step) & mask;
+    }
+  }
+
+  std::size_t find_free(std::size_t hash) const {
+    auto mixed = flat_hash::mix(hash);
+    auto mask = capacity - 1;
+    auto offset = (mixed >> 7) & mask;
+    for (std::size_t step = 0;;) {
+      flat_hash::group g(ctrl + offset);
+      if (auto bits = g.match_empty_or_deleted())
+        return (offset + flat_hash::trailing_zeros(bits)) & mask;
+      step += flat_hash::group_width;
+      offset = (offset + step) & mask;
+    }
+  }
+
+  void set_ctrl(std::size_t index, ctrl_t value) {
+    ctrl[index] = value;
+    // first group is cloned past the end so groups can be loaded at any slot
+    if (index < flat_hash::group_width)
+      ctrl[capacity + index] = value;
+  }
+
+  template <class... Args>
+  std::size_t insert_unique(std::size_t hash, const std::type_info *type,
+                            Args &&... args) {
+    if (growth_left == 0)
+      rehash(count * 2 > capacity ? capacity * 2 : capacity);
+    auto index = find_free(hash);
+    ::new (static_cast<void *>(slots + index)) Slot(std::forward<Args>(args)...);
+    if (ctrl[index] == flat_hash::ctrl_empty)
+      --growth_left;
+    set_ctrl(index, static_cast<ctrl_t>(flat_hash::mix(hash) & 0x7f));
+    hashes[index] = hash;
+    types[index] = type;
+    ++count;
+    return index;
+  }
+
+  void erase_index(std::size_t index) {
+    slots[index].~Slot();
+    set_ctrl(index, flat_hash::ctrl_deleted);
+    --count;
+  }
+
+  void rehash(std::size_t new_capacity) {
+    new_capacity = std::max(new_capacity, flat_hash::min_capacity);
+    any_flat_hash_table result;
+    result.allocate(new_capacity);
+    for (std::size_t i = 0; i < capacity; ++i) {
+      if (!flat_hash::is_full(ctrl[i]))
+        continue;
+      result.insert_unique(hashes[i], types[i], std::move(slots[i]));
+    }
+    swap(result);
+  }
+
+  void allocate(std::size_t new_capacity) {
+    capacity = new_capacity;
+    ctrl = new ctrl_t[capacity + flat_hash::group_width];
+    std::fill(ctrl, ctrl + capacity + flat_hash::group_width,
+              flat_hash::ctrl_empty);
+    slots = std::allocator<Slot>().allocate(capacity);
+    hashes = new std::size_t[capacity];
+    types = new const std::type_info *[capacity];
+    growth_left = max_load(capacity);
+  }
+
+  void destroy_slots() {
+    for (std::size_t i = 0; i < capacity; ++i)
+      if (flat_hash::is_full(ctrl[i]))
+        slots[i].~Slot();
+  }
+
+  void deallocate() {
+    if (!capacity)
+      return;
+    delete[] ctrl;
+    std::allocator<Slot>().deallocate(slots, capacity);
+    delete[] hashes;
+    delete[] types;
+  }
+
+  ctrl_t *ctrl = nullptr;
+  Slot *slots = nullptr;
+  std::size_t *hashes = nullptr;
+  const std::type_info **types = nullptr;
+  std::size_t capacity = 0;
+  std::size_t count = 0;
+  std::size_t growth_left = 0;
+};
+} // namespace detail
+
+// Hash set of hashable, comparable, movable anys stored inline.
+template <class Key>
+class any_flat_hash_set
+    : public detail::any_flat_hash_table<Key, Key, detail::flat_hash::set_policy> {
+  using base = detail::any_flat_hash_table<Key, Key,
+                                           detail::flat_hash::set_policy>;
+
+public:
+  using typename base::iterator;
+
+  std::pair<iterator, bool> insert(const Key &key) {
+    return this->find_or_emplace(base::hash_of(key), base::key_type_of(key),
+                                 base::key_equal(key), key);
+  }
+
+  std::pair<iterator, bool> insert(Key &&key) {
+    return this->find_or_emplace(base::hash_of(key), base::key_type_of(key),
+                                 base::key_equal(key), std::move(key));
+  }
+
+  // any is constructed only if value is not in the set yet
+  template <typename T, class = std::enable_if_t<
+                            !std::is_same<std::decay_t<T>, Key>::value>>
+  std::pair<iterator, bool> insert(T &&value) {
+    using value_type = std::decay_t<T>;
+    const value_type &ref = value;
+    return this->find_or_emplace(detail::flat_hash::hash_as_any(ref),
+                                 &typeid(value_type), base::typed_equal(ref),
+                                 std::forward<T>(value));
+  }
+
+  template <typename T> std::size_t count(const T &key) const {
+    return this->count_key(key);
+  }
+
+  template <typename T> bool contains(const T &key) const {
+    return count(key) != 0;
+  }
+
+  using base::erase;
+  template <typename T, class = std::enable_if_t<!std::is_convertible<
+                            T, typename base::const_iterator>::value>>
+  std::size_t erase(const T &key) {
+    return this->erase_key(key);
+  }
+};
+
+// Hash map from hashable, comparable, movable anys to Value, stored inline.
+template <class Key, class Value>
+class any_flat_hash_map
+    : public detail::any_flat_hash_table<Key, std::pair<Key, Value>,
+                                         detail::flat_hash::map_policy> {
+  using base = detail::any_flat_hash_table<Key, std::pair<Key, Value>,
+                                           detail::flat_hash::map_policy>;
+
+public:
+  using typename base::iterator;
+  using typename base::const_iterator;
+  using mapped_type = Value;
+
+  // keys must not be modified through iterators
+  template <class K, class... Args>
+  std::pair<iterator, bool> try_emplace(K &&key, Args &&... args) {
+    return try_emplace_impl(std::is_same<std::decay_t<K>, Key>(),
+                            std::forward<K>(key), std::forward<Args>(args)...);
+  }
+
+  template <class K, class V>
+  std::pair<iterator, bool> insert_or_assign(K &&key, V &&value) {
+    auto result = try_emplace(std::forward<K>(key), std::forward<V>(value));
+    if (!result.second)
+      result.first->second = std::forward<V>(value);
+    return result;
+  }
+
+  template <class K> Value &operator[](K &&key) {
+    return try_emplace(std::forward<K>(key)).first->second;
+  }
+
+  template <typename T> Value &at(const T &key) {
+    auto it = this->find(key);
+    if (it == this->end())
+      throw std::out_of_range("awt::any_flat_hash_map::at");
+    return it->second;
+  }
+
+  template <typename T> const Value &at(const T &key) const {
+    auto it = this->find(key);
+    if (it == this->end())
+      throw std::out_of_range("awt::any_flat_hash_map::at");
+    return it->second;
+  }
+
+  template <typename T> std::size_t count(const T &key) const {
+    return this->count_key(key);
+  }
+
+  template <typename T> bool contains(const T &key) const {
+    return count(key) != 0;
+  }
+
+  using base::erase;
+  template <typename T, class = std::enable_if_t<
+                            !std::is_convertible<T, const_iterator>::value>>
+  std::size_t erase(const T &key) {
+    return this->erase_key(key);
+  }
+
+private:
+  template <class K, class... Args>
+  std::pair<iterator, bool> try_emplace_impl(std::true_type, K &&key,
+                                             Args &&... args) {
+    const Key &ref = key;
+    return this->find_or_emplace(
+        base::hash_of(ref), base::key_type_of(ref), base::key_equal(ref),
+        std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+  template <class K, class... Args>
+  std::pair<iterator, bool> try_emplace_impl(std::false_type, K &&key,
+                                             Args &&... args) {
+    using key_value_type = std::decay_t<K>;
+    const key_value_type &ref = key;
+    return this->find_or_emplace(
+        detail::flat_hash::hash_as_any(ref), &typeid(key_value_type),
+        base::typed_equal(ref), std::piecewise_construct,
+        std::forward_as_tuple(std::forward<K>(key)),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+};
+} // namespace awt
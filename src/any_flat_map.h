@@ -0,0 +1,298 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <algorithm>
+#include <cassert>
+#include <initializer_list>
+#include <stdexcept>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace awt {
+namespace detail {
+// keys of a single type, they occupy [begin, end) of sorted keys
+struct flat_map_type_range {
+  const std::type_info *type; // nullptr for empty any
+  std::size_t begin;
+  std::size_t end;
+  bool (*less)(const void *, const void *);
+  std::size_t (*lower_bound)(const void *, std::size_t, std::size_t,
+                             const void *);
+};
+
+// order of types in any::operator<, empty any goes first
+inline bool type_less(const std::type_info *lhs, const std::type_info *rhs) {
+  if (!lhs || !rhs)
+    return !lhs && rhs;
+  return std::type_index(*lhs) < std::type_index(*rhs);
+}
+
+inline bool same_type(const std::type_info *lhs, const std::type_info *rhs) {
+  return lhs == rhs || (lhs && rhs && *lhs == *rhs);
+}
+} // namespace detail
+
+// Map from orderable anys kept as two sorted arrays (keys and values). Keys
+// are ordered the same way as any::operator< orders them, so keys of every
+// type form a contiguous sub-array which is searched with comparator of that
+// type. Meant to be built once and queried a lot, single insert or erase is
+// linear.
+template <class Key, class Value> class any_flat_map {
+  using range_t = detail::flat_map_type_range;
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+public:
+  using key_type = Key;
+  using mapped_type = Value;
+  using size_type = std::size_t;
+
+  any_flat_map() = default;
+  // sorts everything at once, the first value is kept for duplicate keys
+  any_flat_map(std::vector<Key> keys, std::vector<Value> values) {
+    build(std::move(keys), std::move(values));
+  }
+  template <class InputIt> any_flat_map(InputIt first, InputIt last) {
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    for (; first != last; ++first) {
+      keys.push_back(first->first);
+      values.push_back(first->second);
+    }
+    build(std::move(keys), std::move(values));
+  }
+  any_flat_map(std::initializer_list<std::pair<Key, Value>> init)
+      : any_flat_map(init.begin(), init.end()) {}
+
+  size_type size() const { return sorted_keys.size(); }
+  bool empty() const { return sorted_keys.empty(); }
+
+  void clear() {
+    sorted_keys.clear();
+    sorted_values.clear();
+    ranges.clear();
+  }
+
+  // i-th key and value correspond to each other
+  const std::vector<Key> &keys() const { return sorted_keys; }
+  const std::vector<Value> &values() const { return sorted_values; }
+
+  // nullptr if key is missing
+  template <typename T> const Value *find(const T &key) const {
+    auto index = find_index(key);
+    return index != npos ? &sorted_values[index] : nullptr;
+  }
+
+  template <typename T> Value *find(const T &key) {
+    return const_cast<Value *>(
+        static_cast<const any_flat_map *>(this)->find(key));
+  }
+
+  template <typename T> const Value &at(const T &key) const {
+    if (auto value = find(key))
+      return *value;
+    throw std::out_of_range("awt::any_flat_map::at");
+  }
+
+  template <typename T> Value &at(const T &key) {
+    return const_cast<Value &>(static_cast<const any_flat_map *>(this)->at(key));
+  }
+
+  template <typename T> bool contains(const T &key) const {
+    return find_index(key) != npos;
+  }
+
+  template <typename T> size_type count(const T &key) const {
+    return contains(key) ? 1 : 0;
+  }
+
+  // returns false and keeps the old value if key is already present
+  bool insert(Key key, Value value) {
+    if (find_index(key) != npos)
+      return false;
+    auto index = insert_position(key);
+    sorted_keys.insert(sorted_keys.begin() + index, std::move(key));
+    sorted_values.insert(sorted_values.begin() + index, std::move(value));
+    update_ranges();
+    return true;
+  }
+
+  template <typename T> size_type erase(const T &key) {
+    auto index = find_index(key);
+    if (index == npos)
+      return 0;
+    sorted_keys.erase(sorted_keys.begin() + index);
+    sorted_values.erase(sorted_values.begin() + index);
+    update_ranges();
+    return 1;
+  }
+
+private:
+  static const std::type_info *type_of(const Key &key) {
+    return key.has_value() ? &key.type() : nullptr;
+  }
+
+  static range_t make_range(const Key &key, std::size_t begin) {
+    range_t result{type_of(key), begin, begin, nullptr, nullptr};
+    if (!key.has_value())
+      return result;
+    result.less = detail::any_access::visit_ftable(key, [](auto f_table) {
+      return detail::trait_f_table<any_trait::orderable>(f_table)
+          ->call_less_than;
+    });
+    result.lower_bound = detail::any_access::visit_ftable(key, [](auto f_table) {
+      return detail::trait_f_table<any_trait::orderable>(f_table)
+          ->call_lower_bound_n;
+    });
+    return result;
+  }
+
+  // ranges are ordered by type the same way as keys, so they are searched
+  // in logarithmic time of the number of types
+  typename std::vector<range_t>::const_iterator
+  range_lower_bound(const std::type_info *type) const {
+    return std::lower_bound(
+        ranges.begin(), ranges.end(), type,
+        [](const range_t &range, const std::type_info *type) {
+          return detail::type_less(range.type, type);
+        });
+  }
+
+  const range_t *find_range(const std::type_info *type) const {
+    auto it = range_lower_bound(type);
+    if (it == ranges.end() || !detail::same_type(it->type, type))
+      return nullptr;
+    return &*it;
+  }
+
+  std::size_t find_index(const Key &key) const {
+    auto range = find_range(type_of(key));
+    if (!range)
+      return npos;
+    if (!range->type)
+      return range->begin;
+    auto value = detail::any_access::data_ptr(key);
+    auto index =
+        range->begin +
+        range->lower_bound(detail::any_access::storage(sorted_keys[range->begin]),
+                           sizeof(Key), range->end - range->begin, value);
+    if (index == range->end ||
+        range->less(value, detail::any_access::data_ptr(sorted_keys[index])))
+      return npos;
+    return index;
+  }
+
+  // lookup by concrete value, comparisons are resolved statically
+  template <typename T, class = std::enable_if_t<
+                            !std::is_same<std::decay_t<T>, Key>::value>>
+  std::size_t find_index(const T &key) const {
+    auto range = find_range(&typeid(T));
+    if (!range)
+      return npos;
+    auto first = sorted_keys.begin() + range->begin;
+    auto last = sorted_keys.begin() + range->end;
+    auto it = std::lower_bound(first, last, key,
+                               [](const Key &lhs, const T &rhs) {
+                                 return detail::any_access::value<T>(lhs) < rhs;
+                               });
+    if (it == last || key < detail::any_access::value<T>(*it))
+      return npos;
+    return static_cast<std::size_t>(it - sorted_keys.begin());
+  }
+
+  std::size_t insert_position(const Key &key) const {
+    auto type = type_of(key);
+    auto range = range_lower_bound(type);
+    if (range == ranges.end())
+      return sorted_keys.size();
+    if (!detail::same_type(range->type, type))
+      return range->begin;
+    return range->begin +
+           range->lower_bound(
+               detail::any_access::storage(sorted_keys[range->begin]),
+               sizeof(Key), range->end - range->begin,
+               detail::any_access::data_ptr(key));
+  }
+
+  void update_ranges() {
+    ranges.clear();
+    for (std::size_t i = 0; i < sorted_keys.size(); ++i) {
+      if (ranges.empty() ||
+          !detail::same_type(ranges.back().type, type_of(sorted_keys[i])))
+        ranges.push_back(make_range(sorted_keys[i], i));
+      ranges.back().end = i + 1;
+    }
+  }
+
+  void build(std::vector<Key> keys, std::vector<Value> values) {
+    assert(keys.size() == values.size());
+    struct group {
+      range_t range;
+      std::vector<std::size_t> positions;
+    };
+    // positions are grouped by type first, so every group is sorted with a
+    // single comparator fetched once
+    std::vector<group> groups;
+    std::unordered_map<const std::type_info *, std::size_t> group_index;
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      auto type = type_of(keys[i]);
+      auto it = group_index.find(type);
+      if (it == group_index.end()) {
+        it = group_index.emplace(type, groups.size()).first;
+        groups.push_back({make_range(keys[i], 0), {}});
+      }
+      groups[it->second].positions.push_back(i);
+    }
+    std::sort(groups.begin(), groups.end(),
+              [](const group &lhs, const group &rhs) {
+                return detail::type_less(lhs.range.type, rhs.range.type);
+              });
+
+    clear();
+    sorted_keys.reserve(keys.size());
+    sorted_values.reserve(values.size());
+    for (std::size_t g = 0; g < groups.size(); ++g) {
+      auto &positions = groups[g].positions;
+      // type_info objects of the same type may differ across modules
+      while (g + 1 < groups.size() &&
+             detail::same_type(groups[g].range.type, groups[g + 1].range.type)) {
+        auto &next = groups[g + 1].positions;
+        positions.insert(positions.end(), next.begin(), next.end());
+        groups.erase(groups.begin() + g + 1);
+        std::sort(positions.begin(), positions.end());
+      }
+      auto range = groups[g].range;
+      range.begin = sorted_keys.size();
+      if (!range.type)
+        positions.resize(1);
+      else {
+        auto less = range.less;
+        auto data = [&](std::size_t i) {
+          return detail::any_access::data_ptr(keys[i]);
+        };
+        std::stable_sort(positions.begin(), positions.end(),
+                         [&](std::size_t lhs, std::size_t rhs) {
+                           return less(data(lhs), data(rhs));
+                         });
+        positions.erase(std::unique(positions.begin(), positions.end(),
+                                    [&](std::size_t lhs, std::size_t rhs) {
+                                      return !less(data(lhs), data(rhs));
+                                    }),
+                        positions.end());
+      }
+      for (auto i : positions) {
+        sorted_keys.push_back(std::move(keys[i]));
+        sorted_values.push_back(std::move(values[i]));
+      }
+      range.end = sorted_keys.size();
+      ranges.push_back(range);
+    }
+  }
+
+  std::vector<Key> sorted_keys;
+  std::vector<Value> sorted_values;
+  std::vector<range_t> ranges;
+};
+} // namespace awt
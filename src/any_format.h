@@ -0,0 +1,219 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+namespace any_trait {
+// values can be written as text into a char buffer with awt::formatter,
+// without iostreams
+struct formattable {};
+} // namespace any_trait
+
+namespace awt {
+namespace detail {
+// copies as much of text as fits, returns its full size like snprintf
+inline std::size_t copy_formatted(const char *text, std::size_t size,
+                                  char *buffer, std::size_t capacity) {
+  if (capacity > 0)
+    std::memcpy(buffer, text, std::min(size, capacity));
+  return size;
+}
+
+// returns the end of the text written to buffer
+template <typename U> char *format_unsigned(U value, char *buffer) {
+  char digits[std::numeric_limits<U>::digits10 + 1];
+  auto p = digits;
+  do {
+    *p++ = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (p != digits)
+    *buffer++ = *--p;
+  return buffer;
+}
+
+template <typename T> char *format_integer(T value, char *buffer) {
+  using unsigned_type = std::make_unsigned_t<T>;
+  auto magnitude = static_cast<unsigned_type>(value);
+  if (value < 0) {
+    *buffer++ = '-';
+    magnitude = static_cast<unsigned_type>(0) - magnitude;
+  }
+  return format_unsigned(magnitude, buffer);
+}
+
+// shortest text reading back as the same value where std::to_chars supports
+// floating point, 17 significant digits otherwise
+template <typename T> char *format_floating(T value, char *buffer, char *end) {
+#if defined(__cpp_lib_to_chars)
+  return std::to_chars(buffer, end, value).ptr;
+#else
+  auto n = std::snprintf(buffer, static_cast<std::size_t>(end - buffer),
+                         "%.*Lg", std::numeric_limits<T>::max_digits10,
+                         static_cast<long double>(value));
+  return buffer + std::max(n, 0);
+#endif
+}
+
+template <typename T, class = void>
+struct is_ostream_insertable : std::false_type {};
+template <typename T>
+struct is_ostream_insertable<
+    T, tmp::void_t<decltype(std::declval<std::ostream &>()
+                            << std::declval<const T &>())>> : std::true_type {};
+} // namespace detail
+
+// Text of T for any_trait::formattable: writes at most capacity chars (no
+// terminating zero) and returns the full size. Arithmetic types and strings
+// are supported, other types fall back to operator<< if they have one.
+// Specialize for others or to avoid iostreams.
+template <typename T, class = void> struct formatter {
+  static_assert(detail::is_ostream_insertable<T>::value,
+                "formatter should be specialized for this type");
+
+  static std::size_t format(const T &value, char *buffer,
+                            std::size_t capacity) {
+    std::ostringstream os;
+    os << value;
+    auto text = os.str();
+    return detail::copy_formatted(text.data(), text.size(), buffer, capacity);
+  }
+};
+
+template <typename T>
+struct formatter<T, std::enable_if_t<std::is_integral<T>::value &&
+                                     !std::is_same<T, bool>::value &&
+                                     !std::is_same<T, char>::value>> {
+  static std::size_t format(T value, char *buffer, std::size_t capacity) {
+    char text[std::numeric_limits<T>::digits10 + 3];
+    auto end = detail::format_integer(value, text);
+    return detail::copy_formatted(text, static_cast<std::size_t>(end - text),
+                                  buffer, capacity);
+  }
+};
+
+template <typename T>
+struct formatter<T, std::enable_if_t<std::is_floating_point<T>::value>> {
+  static std::size_t format(T value, char *buffer, std::size_t capacity) {
+    char text[64];
+    auto end = detail::format_floating(value, text, text + sizeof(text));
+    return detail::copy_formatted(text, static_cast<std::size_t>(end - text),
+                                  buffer, capacity);
+  }
+};
+
+template <> struct formatter<bool> {
+  static std::size_t format(bool value, char *buffer, std::size_t capacity) {
+    return value ? detail::copy_formatted("true", 4, buffer, capacity)
+                 : detail::copy_formatted("false", 5, buffer, capacity);
+  }
+};
+
+template <> struct formatter<char> {
+  static std::size_t format(char value, char *buffer, std::size_t capacity) {
+    return detail::copy_formatted(&value, 1, buffer, capacity);
+  }
+};
+
+template <> struct formatter<std::string> {
+  static std::size_t format(const std::string &value, char *buffer,
+                            std::size_t capacity) {
+    return detail::copy_formatted(value.data(), value.size(), buffer,
+                                  capacity);
+  }
+};
+
+template <> struct formatter<const char *> {
+  static std::size_t format(const char *value, char *buffer,
+                            std::size_t capacity) {
+    return detail::copy_formatted(value, std::strlen(value), buffer,
+                                  capacity);
+  }
+};
+
+namespace detail {
+/* BEGIN any_trait::formattable implementation */
+template <> struct trait_impl<any_trait::formattable> {
+  struct func_impl_base {
+    using format_signature = std::size_t (*)(const void *, char *,
+                                             std::size_t);
+    template <typename T>
+    static std::size_t format(const void *value, char *buffer,
+                              std::size_t capacity) {
+      return formatter<T>::format(*static_cast<const T *>(value), buffer,
+                                  capacity);
+    }
+
+    format_signature call_format = nullptr;
+
+    template <typename T>
+    constexpr func_impl_base(detail::type_t<T>) : call_format(&format<T>) {}
+  };
+
+  template <any_stored_value_type> struct func_impl : func_impl_base {
+    template <typename T>
+    constexpr func_impl(detail::type_t<T> t) : func_impl_base(t) {}
+  };
+
+  template <class RealType> struct any_base {
+    // writes at most capacity chars, returns the size of the whole text,
+    // empty any has no text
+    std::size_t format_to(char *buffer, std::size_t capacity) const {
+      auto real_this = static_cast<const RealType *>(this);
+      if (!real_this->has_value())
+        return 0;
+      auto call = real_this->visit_ftable(
+          [](const func_impl_base *f_table) { return f_table->call_format; });
+      AWT_DETAIL_INSTRUMENT(count_trait_call<any_trait::formattable>();)
+      return call(real_this->data_ptr(), buffer, capacity);
+    }
+
+    // anys which are ostreamable as well use that trait's operator
+    template <class R = RealType,
+              std::enable_if_t<
+                  !std::is_base_of<
+                      trait_impl<any_trait::ostreamable>::any_base<R>,
+                      R>::value,
+                  int> = 0>
+    friend std::ostream &operator<<(std::ostream &os, const any_base &value) {
+      char text[128];
+      auto size = value.format_to(text, sizeof(text));
+      if (size <= sizeof(text))
+        return os.write(text, static_cast<std::streamsize>(size));
+      std::string long_text(size, '\0');
+      value.format_to(&long_text[0], size);
+      return os << long_text;
+    }
+  };
+};
+/* END any_trait::formattable implementation */
+} // namespace detail
+
+// text of a formattable any
+template <class... Traits>
+std::string to_string(const detail::any_t<Traits...> &value) {
+  char text[64];
+  auto size = value.format_to(text, sizeof(text));
+  if (size <= sizeof(text))
+    return std::string(text, size);
+  std::string result(size, '\0');
+  value.format_to(&result[0], size);
+  return result;
+}
+} // namespace awt
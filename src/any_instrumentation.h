@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#if defined(__GNUG__)
+#include <cstdlib>
+#include <cxxabi.h>
+#endif
+
+// Anys count what they do when AWT_ENABLE_INSTRUMENTATION is defined before
+// any_with_traits.h is included, the same way in every translation unit.
+// Without it there are no hooks at all. Counters are kept per thread and
+// summed by awt::instrumentation::snapshot().
+
+namespace awt {
+namespace instrumentation {
+#ifdef AWT_ENABLE_INSTRUMENTATION
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+struct counters {
+  std::uint64_t small_constructions = 0;
+  // large and shared values
+  std::uint64_t heap_constructions = 0;
+  std::uint64_t stateless_constructions = 0;
+  // allocated for values constructed or cloned on the heap
+  std::uint64_t heap_bytes = 0;
+  // copies of values, copies of shared values which only add a reference
+  // are counted too but allocate nothing
+  std::uint64_t clones = 0;
+  std::uint64_t moves = 0;
+  std::uint64_t destructions = 0;
+};
+
+inline counters &operator+=(counters &lhs, const counters &rhs) {
+  lhs.small_constructions += rhs.small_constructions;
+  lhs.heap_constructions += rhs.heap_constructions;
+  lhs.stateless_constructions += rhs.stateless_constructions;
+  lhs.heap_bytes += rhs.heap_bytes;
+  lhs.clones += rhs.clones;
+  lhs.moves += rhs.moves;
+  lhs.destructions += rhs.destructions;
+  return lhs;
+}
+
+struct report {
+  counters total;
+  // keyed by names of stored types
+  std::map<std::string, counters> by_type;
+  // keyed by names of traits, calls made through func tables
+  std::map<std::string, std::uint64_t> trait_calls;
+};
+
+report snapshot();
+} // namespace instrumentation
+
+namespace detail {
+// positions of counters values in instrumentation::counters
+enum counter_slot : std::size_t {
+  small_constructions_slot,
+  heap_constructions_slot,
+  stateless_constructions_slot,
+  heap_bytes_slot,
+  clones_slot,
+  moves_slot,
+  destructions_slot,
+  counter_slot_count
+};
+
+inline std::string demangled_name(const char *name) {
+#if defined(__GNUG__)
+  int status = 0;
+  std::unique_ptr<char, void (*)(void *)> result(
+      abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free);
+  if (status == 0 && result)
+    return result.get();
+#endif
+  return name;
+}
+
+// Counters of a single thread, indexed by type or trait id. Only the owning
+// thread writes them, without read-modify-write operations. Rows are
+// allocated in chunks which are never moved, the mutex is taken only to add
+// chunks and by readers.
+class thread_counters {
+  using cell = std::atomic<std::uint64_t>;
+  static constexpr std::size_t chunk_rows = 64;
+
+  template <std::size_t Width> class table {
+    struct chunk {
+      cell cells[chunk_rows][Width];
+    };
+
+  public:
+    cell *row(std::size_t i, std::mutex &mutex) {
+      auto n = i / chunk_rows;
+      if (n >= chunks.size() || !chunks[n]) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (n >= chunks.size())
+          chunks.resize(n + 1);
+        chunks[n].reset(new chunk());
+      }
+      return chunks[n]->cells[i % chunk_rows];
+    }
+
+    // mutex should be held
+    template <class F> void for_each_row(F f) const {
+      for (std::size_t n = 0; n < chunks.size(); ++n)
+        if (chunks[n])
+          for (std::size_t i = 0; i < chunk_rows; ++i)
+            f(n * chunk_rows + i, chunks[n]->cells[i]);
+    }
+
+  private:
+    std::vector<std::unique_ptr<chunk>> chunks;
+  };
+
+public:
+  static void add(std::size_t type_id, counter_slot slot, std::uint64_t n) {
+    if (auto self = current())
+      bump(self->types.row(type_id, self->mutex)[slot], n);
+  }
+
+  static void add_trait_call(std::size_t trait_id) {
+    if (auto self = current())
+      bump(self->traits.row(trait_id, self->mutex)[0], 1);
+  }
+
+  // adds what is counted so far to rows indexed by ids
+  void collect(std::vector<std::vector<std::uint64_t>> &type_rows,
+               std::vector<std::uint64_t> &trait_rows) {
+    std::lock_guard<std::mutex> lock(mutex);
+    types.for_each_row([&](std::size_t id, const cell *cells) {
+      if (type_rows.size() <= id)
+        type_rows.resize(id + 1,
+                         std::vector<std::uint64_t>(counter_slot_count));
+      for (std::size_t slot = 0; slot < counter_slot_count; ++slot)
+        type_rows[id][slot] += cells[slot].load(std::memory_order_relaxed);
+    });
+    traits.for_each_row([&](std::size_t id, const cell *cells) {
+      if (trait_rows.size() <= id)
+        trait_rows.resize(id + 1);
+      trait_rows[id] += cells[0].load(std::memory_order_relaxed);
+    });
+  }
+
+private:
+  static void bump(cell &c, std::uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  // counters are handed over to the registry when the thread exits, anys
+  // destroyed after that (e.g. other thread_locals) are not counted
+  static thread_counters *current();
+
+  std::mutex mutex;
+  table<counter_slot_count> types;
+  table<1> traits;
+};
+
+// names of counted types and traits, counters of running threads and of
+// finished ones
+class instrumentation_registry {
+public:
+  // never destroyed, anys with static storage duration may outlive it
+  static instrumentation_registry &instance() {
+    static auto r = new instrumentation_registry();
+    return *r;
+  }
+
+  std::size_t add_type(const std::type_info &type) {
+    std::lock_guard<std::mutex> lock(mutex);
+    type_names.push_back(type.name());
+    return type_names.size() - 1;
+  }
+
+  std::size_t add_trait(const std::type_info &trait) {
+    std::lock_guard<std::mutex> lock(mutex);
+    trait_names.push_back(trait.name());
+    return trait_names.size() - 1;
+  }
+
+  void attach(thread_counters *counters) {
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.push_back(counters);
+  }
+
+  void detach(thread_counters *counters) {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters->collect(finished_types, finished_traits);
+    threads.erase(std::find(threads.begin(), threads.end(), counters));
+  }
+
+  instrumentation::report snapshot() {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto type_rows = finished_types;
+    auto trait_rows = finished_traits;
+    for (auto counters : threads)
+      counters->collect(type_rows, trait_rows);
+
+    instrumentation::report result;
+    // rows are collected by chunks, some ids may be not taken yet
+    for (std::size_t id = 0; id < type_rows.size() && id < type_names.size();
+         ++id) {
+      auto &row = type_rows[id];
+      if (std::all_of(row.begin(), row.end(),
+                      [](std::uint64_t n) { return n == 0; }))
+        continue;
+      instrumentation::counters c;
+      c.small_constructions = row[small_constructions_slot];
+      c.heap_constructions = row[heap_constructions_slot];
+      c.stateless_constructions = row[stateless_constructions_slot];
+      c.heap_bytes = row[heap_bytes_slot];
+      c.clones = row[clones_slot];
+      c.moves = row[moves_slot];
+      c.destructions = row[destructions_slot];
+      result.by_type[demangled_name(type_names[id])] += c;
+      result.total += c;
+    }
+    for (std::size_t id = 0;
+         id < trait_rows.size() && id < trait_names.size(); ++id)
+      if (trait_rows[id] != 0)
+        result.trait_calls[demangled_name(trait_names[id])] += trait_rows[id];
+    return result;
+  }
+
+private:
+  std::mutex mutex;
+  std::vector<const char *> type_names;
+  std::vector<const char *> trait_names;
+  std::vector<thread_counters *> threads;
+  std::vector<std::vector<std::uint64_t>> finished_types;
+  std::vector<std::uint64_t> finished_traits;
+};
+
+inline thread_counters *thread_counters::current() {
+  // trivially destructible, so still readable while other thread_locals
+  // are being destroyed
+  static thread_local thread_counters *counters = nullptr;
+  static thread_local bool finished = false;
+  struct owner {
+    ~owner() {
+      instrumentation_registry::instance().detach(counters);
+      delete counters;
+      counters = nullptr;
+      finished = true;
+    }
+  };
+  if (!counters && !finished) {
+    static thread_local owner o;
+    counters = new thread_counters();
+    instrumentation_registry::instance().attach(counters);
+  }
+  return counters;
+}
+
+// ids are dense, in order of first use
+template <typename T> std::size_t counted_type_id() {
+  static const std::size_t id =
+      instrumentation_registry::instance().add_type(typeid(T));
+  return id;
+}
+
+template <class Trait> std::size_t counted_trait_id() {
+  static const std::size_t id =
+      instrumentation_registry::instance().add_trait(typeid(Trait));
+  return id;
+}
+
+template <class Trait> void count_trait_call() {
+  thread_counters::add_trait_call(counted_trait_id<Trait>());
+}
+} // namespace detail
+
+namespace instrumentation {
+inline report snapshot() {
+  return detail::instrumentation_registry::instance().snapshot();
+}
+} // namespace instrumentation
+} // namespace awt
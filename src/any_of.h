@@ -0,0 +1,288 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+namespace awt {
+template <class... Ts> struct type_list {};
+
+namespace detail {
+template <class... Ts> class any_of_t;
+
+// position of T in Ts..., sizeof...(Ts) if it's not there
+template <class T, class... Ts> struct index_of;
+template <class T> struct index_of<T> : std::integral_constant<std::size_t, 0> {};
+template <class T, class... Ts>
+struct index_of<T, T, Ts...> : std::integral_constant<std::size_t, 0> {};
+template <class T, class U, class... Ts>
+struct index_of<T, U, Ts...>
+    : std::integral_constant<std::size_t, 1 + index_of<T, Ts...>::value> {};
+
+template <std::size_t... Values> struct static_max;
+template <> struct static_max<> : std::integral_constant<std::size_t, 1> {};
+template <std::size_t Value, std::size_t... Values>
+struct static_max<Value, Values...>
+    : std::integral_constant<std::size_t,
+                             (Value > static_max<Values...>::value
+                                  ? Value
+                                  : static_max<Values...>::value)> {};
+
+// calls f(type_t<T>()) for T at given index. It's a chain of comparisons
+// with constants which compilers turn into a jump table once inlined, every
+// call site sees the exact type.
+template <class R, std::size_t I, class... Ts> struct index_dispatch;
+template <class R, std::size_t I> struct index_dispatch<R, I> {
+  template <class F> static R call(std::size_t, F &) { std::abort(); }
+};
+template <class R, std::size_t I, class T, class... Ts>
+struct index_dispatch<R, I, T, Ts...> {
+  template <class F> static R call(std::size_t index, F &f) {
+    if (index == I)
+      return f(type_t<T>());
+    return index_dispatch<R, I + 1, Ts...>::call(index, f);
+  }
+};
+
+template <class T0, class... Ts, class F>
+decltype(auto) dispatch_index(type_list<T0, Ts...>, std::size_t index, F &&f) {
+  using result_type = decltype(f(type_t<T0>()));
+  return index_dispatch<result_type, 0, T0, Ts...>::call(index, f);
+}
+
+// values are always stored in place, so value management traits are
+// implemented by any_of itself like for any_ref
+template <class Trait, class RealType>
+using any_of_base = typename any_ref_base<Trait, RealType>::type;
+
+template <class... Ts, class... Traits>
+class any_of_t<type_list<Ts...>, Traits...>
+    : public any_of_base<Traits, any_of_t<type_list<Ts...>, Traits...>>... {
+  using self = any_of_t;
+  using types = type_list<Ts...>;
+  using index_type = std::uint8_t;
+  static_assert(sizeof...(Ts) > 0 && sizeof...(Ts) < 255,
+                "type list should have from 1 to 254 types");
+  constexpr static bool is_copiable =
+      tmp::one_of<any_trait::copiable, Traits...>::value;
+  constexpr static bool is_movable =
+      tmp::one_of<any_trait::movable, Traits...>::value;
+  constexpr static index_type empty_index = 255;
+
+  template <typename T> using index_for = index_of<std::decay_t<T>, Ts...>;
+
+public:
+  any_of_t() noexcept {}
+  template <
+      typename Type,
+      std::enable_if_t<!std::is_same<std::decay_t<Type>, self>::value, int> = 0>
+  any_of_t(Type &&value) {
+    emplace<std::decay_t<Type>>(std::forward<Type>(value));
+  }
+  any_of_t(const self &other) {
+    static_assert(
+        is_copiable,
+        "class copy construction is prohibited due to lack of copiable trait");
+    copy_from(other);
+  }
+  any_of_t(self &&other) noexcept {
+    static_assert(
+        is_movable,
+        "class move construction is prohibited due to lack of movable trait");
+    move_from(other);
+  }
+  ~any_of_t() { reset(); }
+
+  template <
+      typename Type,
+      std::enable_if_t<!std::is_same<std::decay_t<Type>, self>::value, int> = 0>
+  self &operator=(Type &&value) {
+    emplace<std::decay_t<Type>>(std::forward<Type>(value));
+    return *this;
+  }
+  self &operator=(const self &other) {
+    static_assert(
+        is_copiable,
+        "class copy assignment is prohibited due to lack of copiable trait");
+    if (this != &other) {
+      reset();
+      copy_from(other);
+    }
+    return *this;
+  }
+  self &operator=(self &&other) noexcept {
+    static_assert(
+        is_movable,
+        "class move assignment is prohibited due to lack of movable trait");
+    if (this != &other) {
+      reset();
+      move_from(other);
+    }
+    return *this;
+  }
+
+  template <class ValueType, class... Args> ValueType &emplace(Args &&... args) {
+    static_assert(index_for<ValueType>::value < sizeof...(Ts),
+                  "type is not in the type list");
+    reset();
+    auto result = new (&storage) ValueType(std::forward<Args>(args)...);
+    stored_index = static_cast<index_type>(index_for<ValueType>::value);
+    return *result;
+  }
+
+  const std::type_info &type() const {
+    return dispatch([](auto t) -> const std::type_info & {
+      return typeid(typename decltype(t)::type);
+    });
+  }
+  bool has_value() const { return stored_index != empty_index; }
+  bool empty() const { return !has_value(); }
+  // position of the stored type in the type list
+  std::size_t index() const { return stored_index; }
+
+  template <typename T> bool holds() const {
+    return stored_index == index_for<T>::value;
+  }
+
+  void reset() {
+    if (!has_value())
+      return;
+    dispatch([this](auto t) {
+      using type = typename decltype(t)::type;
+      static_cast<type *>(data_ptr())->~type();
+    });
+    stored_index = empty_index;
+  }
+
+  template <typename T> T *cast() {
+    return holds<T>() ? static_cast<T *>(data_ptr()) : nullptr;
+  }
+  template <typename T> const T *cast() const {
+    return holds<T>() ? static_cast<const T *>(data_ptr()) : nullptr;
+  }
+
+  // calls f with a reference to the stored value, throws std::bad_cast if
+  // there is none
+  template <class F> decltype(auto) visit(F &&f) {
+    if (!has_value())
+      throw std::bad_cast{};
+    return dispatch([&](auto t) -> decltype(auto) {
+      return f(*static_cast<typename decltype(t)::type *>(data_ptr()));
+    });
+  }
+  template <class F> decltype(auto) visit(F &&f) const {
+    if (!has_value())
+      throw std::bad_cast{};
+    return dispatch([&](auto t) -> decltype(auto) {
+      return f(*static_cast<const typename decltype(t)::type *>(data_ptr()));
+    });
+  }
+
+private:
+  template <class F> decltype(auto) dispatch(F &&f) const {
+    return dispatch_index(types(), stored_index, f);
+  }
+
+  void copy_from(const self &other) {
+    if (!other.has_value())
+      return;
+    other.dispatch([&](auto t) {
+      using type = typename decltype(t)::type;
+      new (&storage) type(*static_cast<const type *>(other.data_ptr()));
+    });
+    stored_index = other.stored_index;
+  }
+
+  // other is left empty
+  void move_from(self &other) {
+    if (!other.has_value())
+      return;
+    other.dispatch([&](auto t) {
+      using type = typename decltype(t)::type;
+      auto &value = *static_cast<type *>(other.data_ptr());
+      new (&storage) type(std::move(value));
+    });
+    stored_index = other.stored_index;
+    other.reset();
+  }
+
+  void *data_ptr() const {
+    return const_cast<void *>(static_cast<const void *>(&storage));
+  }
+  void *mutable_data_ptr() const { return data_ptr(); }
+
+  // tables are constants, so after the switch calls through them can be
+  // resolved statically
+  template <class VisitorType>
+  auto visit_ftable(const VisitorType &visitor) const noexcept {
+    return dispatch([&](auto t) {
+      return visitor(&func_table_instance<typename decltype(t)::type,
+                                          any_stored_value_type::small,
+                                          Traits...>::value);
+    });
+  }
+
+  std::aligned_storage_t<static_max<sizeof(Ts)...>::value,
+                         static_max<alignof(Ts)...>::value>
+      storage;
+  index_type stored_index = empty_index;
+
+  template <class T> friend struct trait_impl;
+};
+} // namespace detail
+
+// Any restricted to a closed list of types. Stores the value in place plus
+// the index of its type, trait operations switch over the index instead of
+// going through a func table pointer. Supports the same traits as any.
+template <class TypeList, class... Traits>
+using any_of = detail::any_of_t<TypeList, any_trait::destructible, Traits...>;
+
+template <typename Type, class TypeList, class... Traits>
+Type *any_cast(any_of<TypeList, Traits...> *value) {
+  return value ? value->template cast<Type>() : nullptr;
+}
+
+template <typename Type, class TypeList, class... Traits>
+const Type *any_cast(const any_of<TypeList, Traits...> *value) {
+  return value ? value->template cast<Type>() : nullptr;
+}
+
+template <typename Type, class TypeList, class... Traits>
+Type &any_cast(any_of<TypeList, Traits...> &value) {
+  if (auto ptr = value.template cast<Type>())
+    return *ptr;
+  throw std::bad_cast{};
+}
+
+template <typename Type, class TypeList, class... Traits>
+const Type &any_cast(const any_of<TypeList, Traits...> &value) {
+  if (auto ptr = value.template cast<Type>())
+    return *ptr;
+  throw std::bad_cast{};
+}
+
+template <class F, class TypeList, class... Traits>
+decltype(auto) visit(F &&f, any_of<TypeList, Traits...> &value) {
+  return value.visit(std::forward<F>(f));
+}
+
+template <class F, class TypeList, class... Traits>
+decltype(auto) visit(F &&f, const any_of<TypeList, Traits...> &value) {
+  return value.visit(std::forward<F>(f));
+}
+} // namespace awt
+
+namespace std {
+template <class TypeList, class... Traits>
+struct hash<awt::any_of<TypeList, Traits...>> {
+  size_t operator()(const awt::any_of<TypeList, Traits...> &value) const {
+    return value.hash();
+  }
+};
+} // namespace std
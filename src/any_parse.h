@@ -0,0 +1,261 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+namespace any_trait {
+// stored value can be replaced by one parsed from text with awt::parser
+struct parsable {};
+} // namespace any_trait
+
+namespace awt {
+namespace detail {
+template <typename T>
+bool parse_unsigned(const char *first, const char *last, T &value) {
+  if (first == last)
+    return false;
+  T result = 0;
+  for (; first != last; ++first) {
+    auto digit = static_cast<unsigned>(*first - '0');
+    if (digit > 9)
+      return false;
+    if (result > (std::numeric_limits<T>::max() - digit) / 10)
+      return false;
+    result = static_cast<T>(result * 10 + digit);
+  }
+  value = result;
+  return true;
+}
+
+template <typename T>
+bool parse_integer(const char *first, const char *last, T &value,
+                   std::false_type /*is_signed*/) {
+  return parse_unsigned(first, last, value);
+}
+
+template <typename T>
+bool parse_integer(const char *first, const char *last, T &value,
+                   std::true_type /*is_signed*/) {
+  using unsigned_type = std::make_unsigned_t<T>;
+  bool negative = first != last && *first == '-';
+  unsigned_type magnitude;
+  if (!parse_unsigned(first + negative, last, magnitude))
+    return false;
+  auto limit = static_cast<unsigned_type>(std::numeric_limits<T>::max());
+  if (magnitude > limit + negative)
+    return false;
+  value = negative ? static_cast<T>(unsigned_type(0) - magnitude)
+                   : static_cast<T>(magnitude);
+  return true;
+}
+
+inline bool parse_floating(const char *first, const char *last, float &value) {
+  char *end;
+  value = std::strtof(first, &end);
+  return end == last;
+}
+inline bool parse_floating(const char *first, const char *last, double &value) {
+  char *end;
+  value = std::strtod(first, &end);
+  return end == last;
+}
+inline bool parse_floating(const char *first, const char *last,
+                           long double &value) {
+  char *end;
+  value = std::strtold(first, &end);
+  return end == last;
+}
+} // namespace detail
+
+// Parses the whole of [first, last) into value of T for any_trait::parsable
+// and parse_registry, returns false if the text is not a T. Numbers, bool,
+// char and std::string are supported, specialize for other types.
+template <typename T, class = void> struct parser {
+  static_assert(sizeof(T) == 0, "parser should be specialized for this type");
+};
+
+template <typename T>
+struct parser<T, std::enable_if_t<std::is_integral<T>::value &&
+                                  !std::is_same<T, bool>::value &&
+                                  !std::is_same<T, char>::value>> {
+  static bool parse(const char *first, const char *last, T &value) {
+    return detail::parse_integer(first, last, value, std::is_signed<T>());
+  }
+};
+
+// same syntax as std::from_chars: no leading spaces or plus sign
+template <typename T>
+struct parser<T, std::enable_if_t<std::is_floating_point<T>::value>> {
+  static bool parse(const char *first, const char *last, T &value) {
+    if (first == last || *first == '+' ||
+        std::isspace(static_cast<unsigned char>(*first)))
+      return false;
+#if defined(__cpp_lib_to_chars)
+    T result;
+    auto r = std::from_chars(first, last, result);
+    if (r.ec != std::errc() || r.ptr != last)
+      return false;
+    value = result;
+    return true;
+#else
+    // strtod needs a terminated string
+    char buffer[64];
+    std::string long_text;
+    auto size = static_cast<std::size_t>(last - first);
+    const char *text = buffer;
+    if (size < sizeof(buffer)) {
+      std::memcpy(buffer, first, size);
+      buffer[size] = '\0';
+    } else {
+      long_text.assign(first, last);
+      text = long_text.c_str();
+    }
+    T result;
+    errno = 0;
+    if (!detail::parse_floating(text, text + size, result) || errno == ERANGE)
+      return false;
+    value = result;
+    return true;
+#endif
+  }
+};
+
+template <> struct parser<bool> {
+  static bool parse(const char *first, const char *last, bool &value) {
+    auto size = static_cast<std::size_t>(last - first);
+    if ((size == 4 && std::memcmp(first, "true", 4) == 0) ||
+        (size == 1 && *first == '1'))
+      value = true;
+    else if ((size == 5 && std::memcmp(first, "false", 5) == 0) ||
+             (size == 1 && *first == '0'))
+      value = false;
+    else
+      return false;
+    return true;
+  }
+};
+
+template <> struct parser<char> {
+  static bool parse(const char *first, const char *last, char &value) {
+    if (last - first != 1)
+      return false;
+    value = *first;
+    return true;
+  }
+};
+
+template <> struct parser<std::string> {
+  static bool parse(const char *first, const char *last, std::string &value) {
+    value.assign(first, last);
+    return true;
+  }
+};
+
+namespace detail {
+/* BEGIN any_trait::parsable implementation */
+template <> struct trait_impl<any_trait::parsable> {
+  struct func_impl_base {
+    using parse_signature = bool (*)(const char *, const char *, void *);
+    template <typename T>
+    static bool parse(const char *first, const char *last, void *value) {
+      return parser<T>::parse(first, last, *static_cast<T *>(value));
+    }
+
+    parse_signature call_parse = nullptr;
+
+    template <typename T>
+    constexpr func_impl_base(detail::type_t<T>) : call_parse(&parse<T>) {}
+  };
+
+  template <any_stored_value_type> struct func_impl : func_impl_base {
+    template <typename T>
+    constexpr func_impl(detail::type_t<T> t) : func_impl_base(t) {}
+  };
+
+  template <class RealType> struct any_base {
+    // parses text as the type of the stored value, false if it's not one or
+    // the any is empty
+    bool parse(const char *first, const char *last) {
+      auto real_this = static_cast<RealType *>(this);
+      if (!real_this->has_value())
+        return false;
+      auto call = real_this->visit_ftable(
+          [](const func_impl_base *f_table) { return f_table->call_parse; });
+      AWT_DETAIL_INSTRUMENT(count_trait_call<any_trait::parsable>();)
+      return call(first, last, real_this->mutable_data_ptr());
+    }
+
+    bool parse(const std::string &text) {
+      return parse(text.data(), text.data() + text.size());
+    }
+  };
+};
+/* END any_trait::parsable implementation */
+} // namespace detail
+
+// Creates anys of type Any from text given the name of their type. Values
+// are default constructed in the any and parsed in place. Types should be
+// registered before concurrent use.
+template <class Any> class parse_registry {
+public:
+  static parse_registry &instance() {
+    static parse_registry registry;
+    return registry;
+  }
+
+  static std::uint64_t key(const char *type_name) {
+    return detail::fnv1a(type_name);
+  }
+
+  template <typename T> void add(const char *type_name) {
+    static_assert(std::is_default_constructible<T>::value,
+                  "values are parsed into default constructed objects");
+    parsers[key(type_name)] = &parse_as<T>;
+  }
+
+  // replaces out with a value parsed from [first, last), false and empty out
+  // if the text is not valid. Throws std::invalid_argument for unknown types
+  bool parse(std::uint64_t type_key, const char *first, const char *last,
+             Any &out) const {
+    auto it = parsers.find(type_key);
+    if (it == parsers.end())
+      throw std::invalid_argument("unknown type key");
+    return it->second(first, last, out);
+  }
+
+  bool parse(const char *type_name, const std::string &text, Any &out) const {
+    return parse(key(type_name), text.data(), text.data() + text.size(), out);
+  }
+
+private:
+  template <typename T>
+  static bool parse_as(const char *first, const char *last, Any &out) {
+    auto &value = detail::any_access::construct<T>(out);
+    if (parser<T>::parse(first, last, value))
+      return true;
+    out.reset();
+    return false;
+  }
+
+  std::unordered_map<std::uint64_t, bool (*)(const char *, const char *,
+                                             Any &)>
+      parsers;
+};
+} // namespace awt
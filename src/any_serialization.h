@@ -0,0 +1,308 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace any_trait {
+// values can be written with awt::serializer and read back through
+// awt::serialization_registry
+struct serializable {};
+} // namespace any_trait
+
+namespace awt {
+class serialization_error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// appends to a caller provided buffer. Writing past its end is not an error,
+// only the size is counted so the caller can retry with a larger buffer
+class writer {
+public:
+  writer(void *buffer, std::size_t capacity)
+      : buffer(static_cast<char *>(buffer)), capacity(capacity) {}
+
+  void write(const void *data, std::size_t n) {
+    if (n <= capacity - std::min(position, capacity) && n > 0)
+      std::memcpy(buffer + position, data, n);
+    position += n;
+  }
+
+  template <typename T> void write_value(const T &value) {
+    write(&value, sizeof(T));
+  }
+
+  // overwrites already written bytes
+  void write_at(std::size_t offset, const void *data, std::size_t n) {
+    if (offset + n <= capacity)
+      std::memcpy(buffer + offset, data, n);
+  }
+
+  // bytes written, or needed if the buffer is too small
+  std::size_t size() const { return position; }
+  bool overflow() const { return position > capacity; }
+
+private:
+  char *buffer;
+  std::size_t capacity;
+  std::size_t position = 0;
+};
+
+class reader {
+public:
+  reader(const void *data, std::size_t size)
+      : data(static_cast<const char *>(data)), end(this->data + size) {}
+
+  // pointer to the next n bytes, valid as long as the buffer is
+  const char *take(std::size_t n) {
+    if (n > remaining())
+      throw serialization_error("unexpected end of data");
+    auto result = data;
+    data += n;
+    return result;
+  }
+
+  void read(void *target, std::size_t n) {
+    if (n > 0)
+      std::memcpy(target, take(n), n);
+  }
+
+  // T should be trivially copyable, but need not be default constructible
+  template <typename T> T read_value() {
+    std::aligned_storage_t<sizeof(T), alignof(T)> value;
+    read(&value, sizeof(T));
+    return *reinterpret_cast<const T *>(&value);
+  }
+
+  std::size_t remaining() const {
+    return static_cast<std::size_t>(end - data);
+  }
+
+private:
+  const char *data;
+  const char *end;
+};
+
+// Binary format of T in native byte order. Trivially copyable types are
+// copied as they are, specialize for others. Pointers are meaningless once
+// read by another process, so they need a specialization too.
+template <typename T, class = void> struct serializer {
+  static_assert(std::is_trivially_copyable<T>::value &&
+                    !std::is_pointer<T>::value &&
+                    !std::is_member_pointer<T>::value,
+                "serializer should be specialized for this type");
+  static constexpr bool is_raw = true;
+
+  static void write(writer &out, const T &value) { out.write_value(value); }
+  static T read(reader &in) { return in.read_value<T>(); }
+};
+
+template <class Char>
+struct serializer<std::basic_string<Char>,
+                  std::enable_if_t<std::is_trivially_copyable<Char>::value>> {
+  static void write(writer &out, const std::basic_string<Char> &value) {
+    out.write_value(static_cast<std::uint64_t>(value.size()));
+    out.write(value.data(), value.size() * sizeof(Char));
+  }
+  static std::basic_string<Char> read(reader &in) {
+    auto size = in.read_value<std::uint64_t>();
+    auto data = in.take(size * sizeof(Char));
+    std::basic_string<Char> result(size, Char());
+    std::memcpy(&result[0], data, size * sizeof(Char));
+    return result;
+  }
+};
+
+template <class T> struct serializer<std::vector<T>> {
+  static void write(writer &out, const std::vector<T> &value) {
+    out.write_value(static_cast<std::uint64_t>(value.size()));
+    write_elements(out, value, std::is_trivially_copyable<T>());
+  }
+  static std::vector<T> read(reader &in) {
+    auto size = in.read_value<std::uint64_t>();
+    // copied at once into default constructed elements
+    return read_elements(
+        in, size,
+        std::integral_constant<bool,
+                               std::is_trivially_copyable<T>::value &&
+                                   std::is_default_constructible<T>::value>());
+  }
+
+private:
+  static void write_elements(writer &out, const std::vector<T> &value,
+                             std::true_type) {
+    out.write(value.data(), value.size() * sizeof(T));
+  }
+  static void write_elements(writer &out, const std::vector<T> &value,
+                             std::false_type) {
+    for (auto &element : value)
+      serializer<T>::write(out, element);
+  }
+  static std::vector<T> read_elements(reader &in, std::size_t size,
+                                      std::true_type) {
+    auto data = in.take(size * sizeof(T));
+    std::vector<T> result(size);
+    if (size > 0)
+      std::memcpy(result.data(), data, size * sizeof(T));
+    return result;
+  }
+  static std::vector<T> read_elements(reader &in, std::size_t size,
+                                      std::false_type) {
+    std::vector<T> result;
+    result.reserve(std::min<std::size_t>(size, in.remaining()));
+    for (std::size_t i = 0; i < size; ++i)
+      result.push_back(serializer<T>::read(in));
+    return result;
+  }
+};
+
+namespace detail {
+// key of the name T is registered with, 0 while it is not
+template <typename T> struct serialization_key {
+  static std::uint64_t value;
+};
+template <typename T> std::uint64_t serialization_key<T>::value = 0;
+
+template <typename T, class = void>
+struct is_raw_serialized : std::false_type {};
+template <typename T>
+struct is_raw_serialized<T, tmp::void_t<decltype(serializer<T>::is_raw)>>
+    : std::integral_constant<bool, serializer<T>::is_raw> {};
+
+/* BEGIN any_trait::serializable implementation */
+template <> struct trait_impl<any_trait::serializable> {
+  struct func_impl_base {
+    using serialize_signature = void (*)(const void *, writer &);
+    template <typename T>
+    static void serialize(const void *value, writer &out) {
+      serializer<T>::write(out, *static_cast<const T *>(value));
+    }
+
+    // raw values are copied directly, without the call
+    template <typename T>
+    static constexpr serialize_signature make_serialize(std::true_type) {
+      return nullptr;
+    }
+    template <typename T>
+    static constexpr serialize_signature make_serialize(std::false_type) {
+      return &serialize<T>;
+    }
+
+    serialize_signature call_serialize = nullptr;
+    std::uint32_t raw_size = 0;
+    const std::uint64_t *key = nullptr;
+
+    template <typename T>
+    constexpr func_impl_base(detail::type_t<T>)
+        : call_serialize(make_serialize<T>(is_raw_serialized<T>())),
+          raw_size(is_raw_serialized<T>::value ? sizeof(T) : 0),
+          key(&serialization_key<T>::value) {}
+  };
+
+  template <any_stored_value_type> struct func_impl : func_impl_base {
+    template <typename T>
+    constexpr func_impl(detail::type_t<T> t) : func_impl_base(t) {}
+  };
+
+  // record is type key, payload size and payload, key 0 for empty any
+  template <class RealType> struct any_base {
+    void serialize(writer &out) const {
+      auto real_this = static_cast<const RealType *>(this);
+      if (!real_this->has_value()) {
+        out.write_value(std::uint64_t(0));
+        out.write_value(std::uint32_t(0));
+        return;
+      }
+      auto f_table = real_this->visit_ftable(
+          [](const func_impl_base *f_table) { return f_table; });
+      AWT_DETAIL_INSTRUMENT(count_trait_call<any_trait::serializable>();)
+      if (*f_table->key == 0)
+        throw serialization_error(std::string("type is not registered: ") +
+                                  real_this->type().name());
+      out.write_value(*f_table->key);
+      if (!f_table->call_serialize) {
+        out.write_value(f_table->raw_size);
+        out.write(real_this->data_ptr(), f_table->raw_size);
+        return;
+      }
+      auto size_offset = out.size();
+      out.write_value(std::uint32_t(0));
+      f_table->call_serialize(real_this->data_ptr(), out);
+      auto size = static_cast<std::uint32_t>(out.size() - size_offset -
+                                             sizeof(std::uint32_t));
+      out.write_at(size_offset, &size, sizeof(size));
+    }
+  };
+};
+/* END any_trait::serializable implementation */
+} // namespace detail
+
+// Types anys of type Any may be read back as. Keys are FNV-1a hashes of the
+// names, so they are the same for every process registering the same names.
+// Types should be registered before concurrent use.
+template <class Any> class serialization_registry {
+public:
+  static serialization_registry &instance() {
+    static serialization_registry registry;
+    return registry;
+  }
+
+  // a type has the same name for every Any
+  template <typename T> void add(const char *name) {
+    auto key = detail::fnv1a(name);
+    auto &type_key = detail::serialization_key<T>::value;
+    if (type_key != 0 && type_key != key)
+      throw serialization_error(std::string("type is registered as ") +
+                                "another name: " + name);
+    auto it = readers.find(key);
+    if (it != readers.end() && it->second.type != &typeid(T))
+      throw serialization_error(std::string("name is taken: ") + name);
+    type_key = key;
+    readers[key] = {&typeid(T), &read_as<T>};
+  }
+
+  template <typename T> bool contains() const {
+    auto key = detail::serialization_key<T>::value;
+    auto it = readers.find(key);
+    return it != readers.end() && it->second.type == &typeid(T);
+  }
+
+  Any read(reader &in) const {
+    auto key = in.read_value<std::uint64_t>();
+    auto size = in.read_value<std::uint32_t>();
+    auto payload = in.take(size);
+    if (key == 0)
+      return Any();
+    auto it = readers.find(key);
+    if (it == readers.end())
+      throw serialization_error("unknown type key");
+    reader value_in(payload, size);
+    return it->second.read(value_in);
+  }
+
+private:
+  template <typename T> static Any read_as(reader &in) {
+    return Any(serializer<T>::read(in));
+  }
+
+  struct entry {
+    const std::type_info *type;
+    Any (*read)(reader &);
+  };
+
+  std::unordered_map<std::uint64_t, entry> readers;
+};
+
+template <class Any> Any deserialize(reader &in) {
+  return serialization_registry<Any>::instance().read(in);
+}
+} // namespace awt
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "any_with_traits.h"
+#include "any_instrumentation.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace awt {
+using storage_kind = detail::any_stored_value_type;
+
+// How an any of type Any stores a T, e.g. to check that a type stays in the
+// small buffer:
+//   static_assert(awt::storage_info<awt::normal_any, T>::is_inline, "");
+template <class Any, typename T> struct storage_info;
+
+template <class... Traits, typename T>
+struct storage_info<detail::any_t<Traits...>, T> {
+private:
+  using data_t = detail::any_data<Traits...>;
+  static constexpr bool heap_only =
+      detail::tmp::one_of<any_trait::heap_only, Traits...>::value;
+
+public:
+  static constexpr storage_kind kind =
+      data_t::template stored_value_type_for<T>::value;
+  // the value is placed inside the any, no allocation
+  static constexpr bool is_inline =
+      kind == storage_kind::small || kind == storage_kind::stateless;
+  static constexpr std::size_t size = sizeof(T);
+  static constexpr std::size_t alignment = alignof(T);
+  // space an any of this layout has for a value or a pointer to it
+  static constexpr std::size_t buffer_size =
+      heap_only ? sizeof(void *) : detail::any_small_size;
+  // reasons for going to the heap in the default layout
+  static constexpr bool too_large = sizeof(T) > detail::any_small_size;
+  static constexpr bool overaligned =
+      alignof(T) > detail::any_small_alignment;
+  // part of buffer_size not taken by the value or the pointer
+  static constexpr std::size_t wasted_bytes =
+      kind == storage_kind::small
+          ? buffer_size - sizeof(T)
+          : kind == storage_kind::stateless ? buffer_size
+                                            : buffer_size - sizeof(void *);
+  // allocated for the value, reference counter included
+  static constexpr std::size_t heap_bytes =
+      kind == storage_kind::large
+          ? sizeof(T)
+          : kind == storage_kind::shared
+                ? detail::shared_block::header_size + sizeof(T)
+                : 0;
+  static constexpr bool nothrow_move =
+      std::is_nothrow_move_constructible<T>::value;
+  // moving the any copies bytes without calling T's move constructor
+  static constexpr bool trivial_move =
+      !is_inline || std::is_trivially_copyable<T>::value;
+};
+
+template <class... Traits, typename T>
+constexpr storage_kind storage_info<detail::any_t<Traits...>, T>::kind;
+template <class... Traits, typename T>
+constexpr bool storage_info<detail::any_t<Traits...>, T>::is_inline;
+template <class... Traits, typename T>
+constexpr std::size_t storage_info<detail::any_t<Traits...>, T>::size;
+template <class... Traits, typename T>
+constexpr std::size_t storage_info<detail::any_t<Traits...>, T>::alignment;
+template <class... Traits, typename T>
+constexpr std::size_t storage_info<detail::any_t<Traits...>, T>::buffer_size;
+template <class... Traits, typename T>
+constexpr bool storage_info<detail::any_t<Traits...>, T>::too_large;
+template <class... Traits, typename T>
+constexpr bool storage_info<detail::any_t<Traits...>, T>::overaligned;
+template <class... Traits, typename T>
+constexpr std::size_t storage_info<detail::any_t<Traits...>, T>::wasted_bytes;
+template <class... Traits, typename T>
+constexpr std::size_t storage_info<detail::any_t<Traits...>, T>::heap_bytes;
+template <class... Traits, typename T>
+constexpr bool storage_info<detail::any_t<Traits...>, T>::nothrow_move;
+template <class... Traits, typename T>
+constexpr bool storage_info<detail::any_t<Traits...>, T>::trivial_move;
+
+struct heap_type {
+  std::string name;
+  // large and shared values constructed, clones not included
+  std::uint64_t constructions;
+  std::uint64_t heap_bytes;
+};
+
+// Types anys have put on the heap so far, most constructed first. Taken from
+// instrumentation counters, so it is always empty unless
+// AWT_ENABLE_INSTRUMENTATION is defined.
+inline std::vector<heap_type> heap_types() {
+  std::vector<heap_type> result;
+  for (auto &entry : instrumentation::snapshot().by_type)
+    if (entry.second.heap_constructions != 0)
+      result.push_back({entry.first, entry.second.heap_constructions,
+                        entry.second.heap_bytes});
+  std::stable_sort(result.begin(), result.end(),
+                   [](const heap_type &lhs, const heap_type &rhs) {
+                     return lhs.constructions > rhs.constructions;
+                   });
+  return result;
+}
+
+// one line per type: constructions, heap bytes, name
+inline void print_heap_types(std::ostream &os) {
+  for (auto &type : heap_types())
+    os << type.constructions << '\t' << type.heap_bytes << '\t' << type.name
+       << '\n';
+}
+
+// prints heap_types() to stderr at normal program termination
+inline void print_heap_types_at_exit() {
+  std::atexit([] {
+    std::ostringstream os;
+    print_heap_types(os);
+    std::fputs(os.str().c_str(), stderr);
+  });
+}
+} // namespace awt
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <typeindex>
+#include <typeinfo>
+#include <utility>
+
+namespace awt {
+namespace detail {
+constexpr std::size_t switch_table_bits(std::size_t count) {
+  std::size_t bits = 1;
+  while ((std::size_t(1) << bits) < 2 * count)
+    ++bits;
+  return bits;
+}
+
+// maps a stored type to its position in Ts..., npos if it isn't there
+template <class... Ts> class type_switch {
+  static_assert(sizeof...(Ts) > 0, "at least one type is expected");
+  static constexpr std::size_t count = sizeof...(Ts);
+  static constexpr std::size_t bits = switch_table_bits(count);
+  static constexpr std::size_t table_size = std::size_t(1) << bits;
+
+public:
+  static constexpr std::size_t npos = count;
+
+  static std::size_t find(const std::type_info &type) {
+    static const type_switch instance;
+    return instance.lookup(type);
+  }
+
+private:
+  type_switch() {
+    std::fill(std::begin(table), std::end(table), std::uint8_t(0));
+    for (std::size_t i = 0; i < count; ++i) {
+      auto slot = hash(types[i]);
+      while (table[slot] != 0)
+        slot = (slot + 1) & (table_size - 1);
+      table[slot] = static_cast<std::uint8_t>(i + 1);
+      by_name[i] = {std::type_index(*types[i]), i};
+    }
+    std::sort(std::begin(by_name), std::end(by_name));
+  }
+
+  static std::size_t hash(const std::type_info *type) {
+    return static_cast<std::size_t>(
+        (reinterpret_cast<std::uintptr_t>(type) * 0x9e3779b97f4a7c15ull) >>
+        (64 - bits));
+  }
+
+  // type_info objects are usually unique and are found by address, duplicates
+  // (e.g. from shared libraries) and types not in the list by name
+  std::size_t lookup(const std::type_info &type) const {
+    for (auto slot = hash(&type); table[slot] != 0;
+         slot = (slot + 1) & (table_size - 1))
+      if (types[table[slot] - 1] == &type)
+        return table[slot] - 1;
+    auto it = std::lower_bound(std::begin(by_name), std::end(by_name),
+                               std::make_pair(std::type_index(type),
+                                              std::size_t(0)));
+    return it != std::end(by_name) && it->first == std::type_index(type)
+               ? it->second
+               : npos;
+  }
+
+  const std::type_info *types[count] = {&typeid(Ts)...};
+  // entry index + 1, 0 for empty slots
+  std::uint8_t table[table_size];
+  std::pair<std::type_index, std::size_t> by_name[count] = {
+      {typeid(Ts), 0}...};
+};
+
+template <class T, class R, class F> R visit_as(F &visitor, void *value) {
+  return visitor(*static_cast<T *>(value));
+}
+
+template <class F, class... Ts> struct visit_result;
+template <class F, class T, class... Ts> struct visit_result<F, T, Ts...> {
+  using type = decltype(std::declval<F &>()(std::declval<T &>()));
+};
+
+template <class R, class Any, class... Ts, class F>
+R visit_stored(F &visitor, Any &value, void *(*data_ptr)(Any &)) {
+  static_assert(sizeof...(Ts) < 255, "too many candidate types");
+  using call = R (*)(F &, void *);
+  static const call calls[] = {&visit_as<Ts, R, F>...};
+  if (value.has_value()) {
+    auto i = type_switch<std::remove_const_t<Ts>...>::find(value.type());
+    if (i < sizeof...(Ts))
+      return calls[i](visitor, data_ptr(value));
+  }
+  return visitor(value);
+}
+} // namespace detail
+
+using detail::overload;
+
+// calls visitor with the stored value if its type is one of Ts..., with the
+// any itself otherwise (also when it's empty). The type is found with a
+// single table lookup instead of trying any_cast for every candidate.
+// visitor may be built with overload(...), all calls should return the same
+// type.
+template <class... Ts, class F, class... Traits>
+decltype(auto) visit(F &&visitor, any<Traits...> &value) {
+  using any_type = any<Traits...>;
+  using result_type = typename detail::visit_result<F, Ts...>::type;
+  return detail::visit_stored<result_type, any_type, Ts...>(
+      visitor, value, [](any_type &v) {
+        return detail::any_access::mutable_data_ptr(v);
+      });
+}
+
+template <class... Ts, class F, class... Traits>
+decltype(auto) visit(F &&visitor, const any<Traits...> &value) {
+  using any_type = const any<Traits...>;
+  using result_type = typename detail::visit_result<F, const Ts...>::type;
+  return detail::visit_stored<result_type, any_type, const Ts...>(
+      visitor, value,
+      [](any_type &v) { return detail::any_access::data_ptr(v); });
+}
+} // namespace awt
@@ -1,9 +1,26 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <ostream>
 #include <type_traits>
 #include <typeinfo>
 #include <typeindex>
+#include <vector>
+
+#ifdef AWT_ENABLE_INSTRUMENTATION
+#include "any_instrumentation.h"
+#define AWT_DETAIL_INSTRUMENT(...) __VA_ARGS__
+#else
+#define AWT_DETAIL_INSTRUMENT(...)
+#endif
 
 namespace any_trait {
 struct destructible {}; // TODO: enable by default
@@ -14,11 +31,17 @@ struct orderable {};
 struct hashable {};
 struct ostreamable {};
 template <typename Signature> struct callable {};
+// storage policy: every value is kept on the heap, any is two pointers wide
+struct heap_only {};
+// storage policy: large values are reference counted and shared by copies,
+// mutable access copies a shared value first
+struct shared_storage {};
 };
 
 namespace awt {
 namespace detail {
 template <class... Traits> class any_t;
+template <class... Traits> class any_ref_t;
 } // namespace detail
 template <class... Traits>
 using any = detail::any_t<any_trait::destructible, Traits...>;
@@ -28,6 +51,16 @@ using function = any<any_trait::copiable, any_trait::movable,
                      any_trait::callable<Signature>>;
 template <typename Signature>
 using unique_function = any<any_trait::movable, any_trait::callable<Signature>>;
+template <class... Traits> using heap_any = any<any_trait::heap_only, Traits...>;
+using normal_heap_any = heap_any<any_trait::copiable, any_trait::movable>;
+template <class... Traits>
+using shared_any = any<any_trait::shared_storage, Traits...>;
+using normal_shared_any =
+    shared_any<any_trait::copiable, any_trait::movable>;
+// non-owning reference to a value placed in external storage, exposes the
+// same trait interface as any<Traits...> minus value management
+template <class... Traits>
+using any_ref = detail::any_ref_t<any_trait::destructible, Traits...>;
 
 template <typename Type, typename... Traits>
 Type *any_cast(any<Traits...> *value);
@@ -45,6 +78,9 @@ template <bool... Values>
 struct static_or
     : is_not_same<bool_pack<Values...>,
                   bool_pack<(second_bool<Values, false>::value)...>> {};
+template <bool... Values>
+struct static_and : std::is_same<bool_pack<true, Values...>,
+                                 bool_pack<Values..., true>> {};
 template <class Needle, class... Haystack>
 struct one_of : static_or<std::is_same<Needle, Haystack>::value...> {};
 
@@ -103,6 +139,16 @@ template <class T> inline void hash_combine(std::size_t &seed, const T &v) {
   seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
 }
 
+// 64-bit FNV-1a, stable keys for type names
+inline std::uint64_t fnv1a(const char *name) {
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+  for (; *name; ++name) {
+    hash ^= static_cast<unsigned char>(*name);
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
 template <typename T> struct forbid_implicit_casts {
   forbid_implicit_casts(T value_arg) : value(value_arg) {}
   T value;
@@ -111,19 +157,119 @@ template <typename T> struct forbid_implicit_casts {
 enum class any_stored_value_type : char {
   large,
   small,
+  stateless, // empty trivial types, nothing is constructed or destroyed
+  shared,    // large values of shared anys, see shared_block
 };
 // possibly it's cooler to allow to specify it differently for different types
 // of anys
 constexpr auto any_small_size = 24;
+// small buffer shares a union with the data pointer, more strictly aligned
+// values are kept on the heap
+constexpr auto any_small_alignment = alignof(void *);
 
 struct any_all_types {};
 
+// captureless lambdas are not default constructible before C++20, so trivial
+// copy is required instead of trivial construction
+template <typename T>
+using is_stateless =
+    std::integral_constant<bool, std::is_empty<T>::value &&
+                                     std::is_trivially_copy_constructible<
+                                         T>::value &&
+                                     std::is_trivially_destructible<T>::value>;
+
 template <typename T>
-using get_any_stored_value_type =
-    std::integral_constant<any_stored_value_type,
-                           sizeof(T) <= any_small_size
-                               ? any_stored_value_type::small
-                               : any_stored_value_type::large>;
+using get_any_stored_value_type = std::integral_constant<
+    any_stored_value_type,
+    is_stateless<T>::value
+        ? any_stored_value_type::stateless
+        : sizeof(T) <= any_small_size && alignof(T) <= any_small_alignment
+              ? any_stored_value_type::small
+              : any_stored_value_type::large>;
+
+// storage holds a pointer to the value
+template <any_stored_value_type value_type>
+using is_heap_stored = std::integral_constant<
+    bool, value_type == any_stored_value_type::large ||
+              value_type == any_stored_value_type::shared>;
+
+// access to a value given the address of any's storage (small buffer or data
+// pointer), used by kernels working on arrays of anys
+template <any_stored_value_type value_type> struct stored_value_access {
+  template <typename T> static T &get(void *storage) {
+    return *static_cast<T *>(storage);
+  }
+};
+
+template <> struct stored_value_access<any_stored_value_type::large> {
+  template <typename T> static T &get(void *storage) {
+    return **static_cast<T **>(storage);
+  }
+};
+
+template <>
+struct stored_value_access<any_stored_value_type::shared>
+    : stored_value_access<any_stored_value_type::large> {};
+
+// heap block of a shared value, the reference counter is placed in front of
+// the value so that the data pointer still points to the value itself
+struct shared_block {
+  using counter_type = std::atomic<std::size_t>;
+  static constexpr std::size_t header_size = alignof(std::max_align_t);
+  static_assert(sizeof(counter_type) <= header_size, "");
+
+  template <typename T, class... Args> static T *make(Args &&... args) {
+    static_assert(alignof(T) <= header_size, "overaligned types unsupported");
+    auto block = static_cast<char *>(::operator new(header_size + sizeof(T)));
+    T *value;
+    try {
+      value = new (block + header_size) T(std::forward<Args>(args)...);
+    } catch (...) {
+      ::operator delete(block);
+      throw;
+    }
+    new (block) counter_type(1);
+    return value;
+  }
+
+  static counter_type &counter(const void *value) {
+    return *reinterpret_cast<counter_type *>(
+        const_cast<char *>(static_cast<const char *>(value)) - header_size);
+  }
+
+  static void add_ref(const void *value) {
+    counter(value).fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static bool is_unique(const void *value) {
+    return counter(value).load(std::memory_order_acquire) == 1;
+  }
+
+  template <typename T> static void release(void *value) {
+    auto &refs = counter(value);
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+      return;
+    static_cast<T *>(value)->~T();
+    refs.~counter_type();
+    ::operator delete(static_cast<char *>(value) - header_size);
+  }
+};
+
+// stored type as seen by instrumentation, nothing without it
+#ifdef AWT_ENABLE_INSTRUMENTATION
+struct instrumented_type {
+  template <typename T>
+  constexpr instrumented_type(detail::type_t<T>)
+      : counted_id(&counted_type_id<T>), value_size(sizeof(T)) {}
+
+  std::size_t (*counted_id)();
+  std::size_t value_size;
+};
+#else
+struct instrumented_type {
+  template <typename T> constexpr instrumented_type(detail::type_t<T>) {}
+};
+#endif
 
 template <class Trait> struct trait_impl {
   static_assert(std::is_same<Trait, void>::value, "Trait is not implemented");
@@ -159,8 +305,30 @@ struct trait_impl<any_trait::destructible>::func_impl<
     return ::delete (static_cast<T *>(other));
   }
 
+  // values are allocated with plain new, which aligns them no further than
+  // max_align_t before C++17
+  template <typename T>
+  constexpr func_impl(detail::type_t<T>) : call_dtor(&dtor<T>) {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "overaligned types unsupported");
+  }
+};
+
+template <>
+struct trait_impl<any_trait::destructible>::func_impl<
+    any_stored_value_type::stateless> {
+  template <typename T> constexpr func_impl(detail::type_t<T>) {}
+};
+
+// drops a reference, the last one destroys the value
+template <>
+struct trait_impl<any_trait::destructible>::func_impl<
+    any_stored_value_type::shared> {
+  dtor_signature call_dtor = nullptr;
+
   template <typename T>
-  constexpr func_impl(detail::type_t<T>) : call_dtor(&dtor<T>) {}
+  constexpr func_impl(detail::type_t<T>)
+      : call_dtor(&shared_block::release<T>) {}
 };
 
 template <class RealType> struct trait_impl<any_trait::destructible>::any_base {
@@ -168,9 +336,19 @@ template <class RealType> struct trait_impl<any_trait::destructible>::any_base {
     auto real_this = static_cast<RealType *>(this);
     if (!real_this->has_value())
       return;
-    real_this->visit_ftable(
-        [&](auto f_table) { f_table->call_dtor(real_this->data_ptr()); });
-    real_this->d.type_data.t_info = nullptr;
+    AWT_DETAIL_INSTRUMENT(real_this->count(destructions_slot);)
+    real_this->visit_ftable(overload(
+        [&](const func_impl<any_stored_value_type::small> *f_table) {
+          f_table->call_dtor(real_this->data_ptr());
+        },
+        [&](const func_impl<any_stored_value_type::large> *f_table) {
+          f_table->call_dtor(real_this->data_ptr());
+        },
+        [&](const func_impl<any_stored_value_type::shared> *f_table) {
+          f_table->call_dtor(real_this->data_ptr());
+        },
+        [](const func_impl<any_stored_value_type::stateless> *) {}));
+    real_this->d.type_data.clear();
   }
 };
 /* END any_trait::destructible implementation */
@@ -209,6 +387,26 @@ struct trait_impl<any_trait::copiable>::func_impl<
   constexpr func_impl(detail::type_t<T>) : call_copy(&copy<T>) {}
 };
 
+template <>
+struct trait_impl<any_trait::copiable>::func_impl<
+    any_stored_value_type::stateless> {
+  template <typename T> constexpr func_impl(detail::type_t<T>) {}
+};
+
+// copies only add a reference, clone is used for copy-on-write
+template <>
+struct trait_impl<any_trait::copiable>::func_impl<
+    any_stored_value_type::shared> {
+  using clone_signature = void *(*)(const void *);
+  clone_signature call_clone;
+  template <typename T> static void *clone(const void *other) {
+    return shared_block::make<T>(*static_cast<const T *>(other));
+  }
+
+  template <typename T>
+  constexpr func_impl(detail::type_t<T>) : call_clone(&clone<T>) {}
+};
+
 template <class RealType> struct trait_impl<any_trait::copiable>::any_base {
   void clone(const RealType &other) {
     auto real_this = static_cast<RealType *>(this);
@@ -219,11 +417,18 @@ template <class RealType> struct trait_impl<any_trait::copiable>::any_base {
 
     real_this->visit_ftable(overload(
         [&](const func_impl<any_stored_value_type::small> *f_table) {
-          f_table->call_copy(real_this->d.small_data, other.d.small_data);
+          f_table->call_copy(real_this->data_ptr(), other.data_ptr());
         },
         [&](const func_impl<any_stored_value_type::large> *f_table) {
           real_this->d.data = f_table->call_clone(other.d.data);
-        }));
+        },
+        [&](const func_impl<any_stored_value_type::shared> *) {
+          shared_block::add_ref(other.d.data);
+          real_this->d.data = other.d.data;
+        },
+        [](const func_impl<any_stored_value_type::stateless> *) {}));
+    AWT_DETAIL_INSTRUMENT(
+        real_this->count(clones_slot, !real_this->d.is_shared());)
   }
 };
 /* END any_trait::copiable implementation */
@@ -242,15 +447,40 @@ struct trait_impl<any_trait::movable>::func_impl<any_stored_value_type::large> {
 
 template <>
 struct trait_impl<any_trait::movable>::func_impl<any_stored_value_type::small> {
+  // relocation, source is destroyed after the move
   using move_signature = void (*)(void *, void *);
   template <typename T> static void do_move(void *target, void *source) {
-    new (target) T(std::move(*static_cast<T *>(source)));
+    auto &value = *static_cast<T *>(source);
+    new (target) T(std::move(value));
+    value.~T();
+  }
+  // trivially copyable values are relocated by copying the small buffer
+  template <typename T>
+  static constexpr move_signature make_move(std::true_type) {
+    return nullptr;
   }
   template <typename T>
-  constexpr func_impl(detail::type_t<T>) : call_move(&do_move<T>) {}
+  static constexpr move_signature make_move(std::false_type) {
+    return &do_move<T>;
+  }
+  template <typename T>
+  constexpr func_impl(detail::type_t<T>)
+      : call_move(make_move<T>(std::is_trivially_copyable<T>())) {}
   move_signature call_move = nullptr;
 };
 
+template <>
+struct trait_impl<any_trait::movable>::func_impl<
+    any_stored_value_type::stateless> {
+  template <typename T> constexpr func_impl(detail::type_t<T>) {}
+};
+
+template <>
+struct trait_impl<any_trait::movable>::func_impl<
+    any_stored_value_type::shared> {
+  template <typename T> constexpr func_impl(detail::type_t<T>) {}
+};
+
 template <class RealType> struct trait_impl<any_trait::movable>::any_base {
   void move_from(RealType &&other) {
     auto real_this = static_cast<RealType *>(this);
@@ -258,29 +488,56 @@ template <class RealType> struct trait_impl<any_trait::movable>::any_base {
     real_this->d.type_data = other.d.type_data;
     real_this->visit_ftable(overload(
         [&](const func_impl<any_stored_value_type::small> *f_table) {
-          f_table->call_move(real_this->data_ptr(), other.data_ptr());
+          if (f_table->call_move)
+            f_table->call_move(real_this->data_ptr(), other.data_ptr());
+          else
+            std::memcpy(real_this->data_ptr(), other.data_ptr(),
+                        detail::any_small_size);
         },
         [&](const func_impl<any_stored_value_type::large> *) {
           real_this->d.data = other.d.data;
-        }));
+        },
+        [&](const func_impl<any_stored_value_type::shared> *) {
+          real_this->d.data = other.d.data;
+        },
+        [](const func_impl<any_stored_value_type::stateless> *) {}));
     other.d.type_data.clear();
+    AWT_DETAIL_INSTRUMENT(real_this->count(moves_slot);)
   }
 };
 /* END any_trait::movable implementation */
 
 /* BEGIN any_trait::comparable implementation */
 template <> struct trait_impl<any_trait::comparable> {
-  template <any_stored_value_type> struct func_impl {
+  template <any_stored_value_type value_type> struct func_impl {
     using equal_to_signature = bool (*)(const void *, const void *);
     template <typename T>
     static bool equal_to(const void *first, const void *second) {
       return *static_cast<const T *>(first) == *static_cast<const T *>(second);
     }
 
+    // pairwise comparison of n storages laid out with given strides
+    using equal_to_n_signature = void (*)(void *, std::size_t, void *,
+                                          std::size_t, std::size_t, bool *);
+    template <typename T>
+    static void equal_to_n(void *first, std::size_t first_stride, void *second,
+                           std::size_t second_stride, std::size_t n,
+                           bool *out) {
+      using access = stored_value_access<value_type>;
+      auto lhs = static_cast<char *>(first);
+      auto rhs = static_cast<char *>(second);
+      for (std::size_t i = 0; i < n;
+           ++i, lhs += first_stride, rhs += second_stride)
+        out[i] = access::template get<const T>(lhs) ==
+                 access::template get<const T>(rhs);
+    }
+
     equal_to_signature call_equal_to = nullptr;
+    equal_to_n_signature call_equal_to_n = nullptr;
 
     template <typename T>
-    constexpr func_impl(detail::type_t<T>) : call_equal_to(&equal_to<T>) {}
+    constexpr func_impl(detail::type_t<T>)
+        : call_equal_to(&equal_to<T>), call_equal_to_n(&equal_to_n<T>) {}
   };
 
   template <class RealType> struct any_base {
@@ -291,6 +548,7 @@ template <> struct trait_impl<any_trait::comparable> {
         return real_this->has_value() == other.has_value();
       return real_this->type() == other.type() &&
              real_this->visit_ftable([&](auto f_table) {
+               AWT_DETAIL_INSTRUMENT(count_trait_call<any_trait::comparable>();)
                return f_table->call_equal_to(real_this->data_ptr(),
                                              other.data_ptr());
              });
@@ -325,18 +583,129 @@ template <> struct trait_impl<any_trait::comparable> {
 /* END any_trait::comparable implementation */
 
 /* BEGIN any_trait::orderable implementation */
+// sorts values of n storages laid out with given stride, all holding T
+template <any_stored_value_type value_type, typename T, class = void>
+struct storage_sorter {
+  static constexpr bool is_available =
+      std::is_move_constructible<T>::value && std::is_move_assignable<T>::value;
+
+  static void sort(char *first, std::size_t stride, std::size_t n) {
+    using access = stored_value_access<value_type>;
+    std::vector<T> values;
+    values.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      auto &value = access::template get<T>(first + i * stride);
+      values.push_back(std::move(value));
+      value.~T();
+    }
+    auto restore = [&] {
+      for (std::size_t i = 0; i < n; ++i)
+        new (first + i * stride) T(std::move(values[i]));
+    };
+    try {
+      std::sort(values.begin(), values.end());
+    } catch (...) {
+      restore();
+      throw;
+    }
+    restore();
+  }
+};
+
+// arithmetic and other trivially copyable values are just copied around
+template <any_stored_value_type value_type, typename T>
+struct storage_sorter<value_type, T,
+                      std::enable_if_t<!is_heap_stored<value_type>::value &&
+                                       std::is_trivially_copyable<T>::value>> {
+  static constexpr bool is_available = std::is_copy_assignable<T>::value;
+
+  // copied to uninitialized storage, T need not be default constructible
+  static void sort(char *first, std::size_t stride, std::size_t n) {
+    using storage = std::aligned_storage_t<sizeof(T), alignof(T)>;
+    std::unique_ptr<storage[]> buffer(new storage[n]);
+    auto values = reinterpret_cast<T *>(buffer.get());
+    for (std::size_t i = 0; i < n; ++i)
+      std::memcpy(values + i, first + i * stride, sizeof(T));
+    std::sort(values, values + n);
+    for (std::size_t i = 0; i < n; ++i)
+      std::memcpy(first + i * stride, values + i, sizeof(T));
+  }
+};
+
+// heap values are not touched, only pointers to them are reordered
+template <any_stored_value_type value_type, typename T>
+struct storage_sorter<value_type, T,
+                      std::enable_if_t<is_heap_stored<value_type>::value>> {
+  static constexpr bool is_available = true;
+
+  static void sort(char *first, std::size_t stride, std::size_t n) {
+    std::vector<T *> pointers(n);
+    for (std::size_t i = 0; i < n; ++i)
+      std::memcpy(&pointers[i], first + i * stride, sizeof(T *));
+    std::sort(pointers.begin(), pointers.end(),
+              [](const T *lhs, const T *rhs) { return *lhs < *rhs; });
+    for (std::size_t i = 0; i < n; ++i)
+      std::memcpy(first + i * stride, &pointers[i], sizeof(T *));
+  }
+};
+
 template <> struct trait_impl<any_trait::orderable> {
-  template <any_stored_value_type> struct func_impl {
+  template <any_stored_value_type value_type> struct func_impl {
     using less_than_signature = bool (*)(const void *, const void *);
     template <typename T>
     static bool less_than(const void *first, const void *second) {
       return *static_cast<const T *>(first) < *static_cast<const T *>(second);
     }
 
+    // sorts values of n storages holding the same type
+    using sort_n_signature = void (*)(void *, std::size_t, std::size_t);
+    template <typename T>
+    static void sort_n(void *first, std::size_t stride, std::size_t n) {
+      storage_sorter<value_type, T>::sort(static_cast<char *>(first), stride,
+                                          n);
+    }
+
+    // index of the first of n sorted storages not less than given value
+    using lower_bound_n_signature = std::size_t (*)(const void *, std::size_t,
+                                                    std::size_t, const void *);
+    template <typename T>
+    static std::size_t lower_bound_n(const void *first, std::size_t stride,
+                                     std::size_t n, const void *value) {
+      using access = stored_value_access<value_type>;
+      auto &key = *static_cast<const T *>(value);
+      auto storage = static_cast<char *>(const_cast<void *>(first));
+      std::size_t result = 0;
+      while (n > 0) {
+        auto step = n / 2;
+        if (access::template get<T>(storage + (result + step) * stride) < key) {
+          result += step + 1;
+          n -= step + 1;
+        } else
+          n = step;
+      }
+      return result;
+    }
+
+    template <typename T>
+    static constexpr sort_n_signature make_sort_n(std::true_type) {
+      return &sort_n<T>;
+    }
+    template <typename T>
+    static constexpr sort_n_signature make_sort_n(std::false_type) {
+      return nullptr;
+    }
+
     less_than_signature call_less_than = nullptr;
+    lower_bound_n_signature call_lower_bound_n = nullptr;
+    sort_n_signature call_sort_n = nullptr;
 
     template <typename T>
-    constexpr func_impl(detail::type_t<T>) : call_less_than(&less_than<T>) {}
+    constexpr func_impl(detail::type_t<T>)
+        : call_less_than(&less_than<T>),
+          call_lower_bound_n(&lower_bound_n<T>),
+          call_sort_n(make_sort_n<T>(std::integral_constant<
+                                     bool, storage_sorter<value_type, T>::
+                                               is_available>())) {}
   };
 
   template <class RealType> struct any_base {
@@ -350,6 +719,7 @@ template <> struct trait_impl<any_trait::orderable> {
                std::type_index(other.type());
 
       return real_this->visit_ftable([&](auto f_table) {
+        AWT_DETAIL_INSTRUMENT(count_trait_call<any_trait::orderable>();)
         return f_table->call_less_than(real_this->data_ptr(), other.data_ptr());
       });
     }
@@ -404,16 +774,31 @@ template <> struct trait_impl<any_trait::orderable> {
 
 /* BEGIN any_trait::hashable implementation */
 template <> struct trait_impl<any_trait::hashable> {
-  template <any_stored_value_type> struct func_impl {
+  template <any_stored_value_type value_type> struct func_impl {
     using hash_signature = std::size_t (*)(const void *);
     template <typename T> static std::size_t hash_func(const void *value) {
       return std::hash<T>()(*static_cast<const T *>(value));
     }
 
+    // hashes of n storages laid out with given stride, without type hash
+    using hash_n_signature = void (*)(void *, std::size_t, std::size_t,
+                                      std::size_t *);
+    template <typename T>
+    static void hash_n(void *first, std::size_t stride, std::size_t n,
+                       std::size_t *out) {
+      using access = stored_value_access<value_type>;
+      std::hash<T> hasher;
+      auto storage = static_cast<char *>(first);
+      for (std::size_t i = 0; i < n; ++i, storage += stride)
+        out[i] = hasher(access::template get<const T>(storage));
+    }
+
     hash_signature call_hash = nullptr;
+    hash_n_signature call_hash_n = nullptr;
 
     template <typename T>
-    constexpr func_impl(detail::type_t<T>) : call_hash(&hash_func<T>) {}
+    constexpr func_impl(detail::type_t<T>)
+        : call_hash(&hash_func<T>), call_hash_n(&hash_n<T>) {}
   };
 
   template <class RealType> struct any_base {
@@ -422,13 +807,13 @@ template <> struct trait_impl<any_trait::hashable> {
       if (!real_this->has_value())
         return 7927u; // hash for empty any
       std::size_t res = real_this->visit_ftable([&](auto f_table) {
+        AWT_DETAIL_INSTRUMENT(count_trait_call<any_trait::hashable>();)
         return f_table->call_hash(real_this->data_ptr());
       });
       detail::hash_combine(
           res,
           std::type_index(
-              *real_this->d.type_data
-                   .t_info)); // adding type_info hash to original type hash
+              real_this->type())); // adding type_info hash to original type hash
       return res;
     };
   };
@@ -443,16 +828,48 @@ struct trait_impl<any_trait::callable<Ret(ArgTypes...)>> {
     using signature = Ret (*)(const void *, ArgTypes...);
     template <typename T>
     static Ret func(const void *object, ArgTypes... args) {
-      return (*static_cast<const T *>(object))(args...);
+      return (*static_cast<const T *>(object))(
+          std::forward<ArgTypes>(args)...);
     }
     signature call_call = nullptr;
     template <typename T>
     constexpr func_impl_base(detail::type_t<T>) : call_call(&func<T>) {}
   };
 
-  template <any_stored_value_type> struct func_impl : func_impl_base {
+  // the same arguments are passed to every call so they have to be usable as
+  // lvalues
+  using batch_invocable = tmp::static_and<
+      std::is_constructible<ArgTypes, std::remove_reference_t<ArgTypes> &>::
+          value...>;
+
+  template <any_stored_value_type value_type>
+  struct func_impl : func_impl_base {
+    // calls n storages laid out with given stride, results are discarded
+    using signature_n = void (*)(void *, std::size_t, std::size_t,
+                                 ArgTypes...);
     template <typename T>
-    constexpr func_impl(detail::type_t<T> t) : func_impl_base(t) {}
+    static void func_n(void *first, std::size_t stride, std::size_t n,
+                       ArgTypes... args) {
+      using access = stored_value_access<value_type>;
+      auto storage = static_cast<char *>(first);
+      for (std::size_t i = 0; i < n; ++i, storage += stride)
+        access::template get<const T>(storage)(args...);
+    }
+
+    template <typename T>
+    static constexpr signature_n make_call_n(std::true_type) {
+      return &func_n<T>;
+    }
+    template <typename T>
+    static constexpr signature_n make_call_n(std::false_type) {
+      return nullptr;
+    }
+
+    signature_n call_call_n = nullptr;
+
+    template <typename T>
+    constexpr func_impl(detail::type_t<T> t)
+        : func_impl_base(t), call_call_n(make_call_n<T>(batch_invocable())) {}
   };
 
   template <class RealType> struct any_base {
@@ -463,10 +880,13 @@ struct trait_impl<any_trait::callable<Ret(ArgTypes...)>> {
       auto real_this = static_cast<const RealType *>(this);
       if (!real_this->has_value())
         throw std::bad_function_call{};
-      return real_this->visit_ftable([&](const func_impl_base *f_table) {
-        return f_table->call_call(real_this->data_ptr(),
-                                  std::forward<UserArgTypes>(args)...);
-      });
+      // visit_ftable is noexcept, the call itself is made outside of it so
+      // exceptions reach the caller
+      auto call = real_this->visit_ftable(
+          [](const func_impl_base *f_table) { return f_table->call_call; });
+      AWT_DETAIL_INSTRUMENT(
+          count_trait_call<any_trait::callable<Ret(ArgTypes...)>>();)
+      return call(real_this->data_ptr(), std::forward<UserArgTypes>(args)...);
     }
   };
 };
@@ -498,6 +918,7 @@ struct trait_impl<any_trait::ostreamable> {
       auto real_this = static_cast<const RealType *>(this);
       if (!real_this->has_value())
         return os;
+      AWT_DETAIL_INSTRUMENT(count_trait_call<any_trait::ostreamable>();)
          real_this->visit_ftable([&](const func_impl_base *f_table) {
          f_table->call_insert_to_ostream(real_this->data_ptr(), os);
       });
@@ -509,6 +930,28 @@ struct trait_impl<any_trait::ostreamable> {
 };
 /* END any_trait::ostreamable implementation */
 
+/* BEGIN any_trait::heap_only implementation */
+// pure storage policy marker, contributes nothing to func tables
+template <> struct trait_impl<any_trait::heap_only> {
+  template <any_stored_value_type> struct func_impl {
+    template <typename T> constexpr func_impl(detail::type_t<T>) {}
+  };
+
+  template <class RealType> struct any_base {};
+};
+/* END any_trait::heap_only implementation */
+
+/* BEGIN any_trait::shared_storage implementation */
+// storage policy marker as well
+template <> struct trait_impl<any_trait::shared_storage> {
+  template <any_stored_value_type> struct func_impl {
+    template <typename T> constexpr func_impl(detail::type_t<T>) {}
+  };
+
+  template <class RealType> struct any_base {};
+};
+/* END any_trait::shared_storage implementation */
+
 /* BEGIN call internal function trait macro */
 
 #define AWT_DETAIL_MEMBER_FUNCTION_CALL(FUNC_NAME, ...)                        \
@@ -557,10 +1000,11 @@ struct trait_impl<any_trait::TRAIT_NAME> {                                     \
         auto real_this = static_cast<RealType *>(this);                        \
         if (!real_this->has_value())                                           \
           throw std::bad_function_call{};                                      \
-        return real_this->visit_ftable([&](const func_impl_base *f_table) {    \
-          return f_table->func_call(real_this->data_ptr(),                     \
-                                    std::forward<ArgTypes>(args)...);          \
-        });                                                                    \
+        auto call = real_this->visit_ftable(                                   \
+            [](const func_impl_base *f_table) { return f_table->func_call; }); \
+        AWT_DETAIL_INSTRUMENT(count_trait_call<any_trait::TRAIT_NAME>();)      \
+        return call(real_this->mutable_data_ptr(),                             \
+                    std::forward<ArgTypes>(args)...);                          \
       }                                                                        \
     };                                                                         \
     template <class RealType>                                                  \
@@ -585,11 +1029,21 @@ struct trait_impl<any_trait::TRAIT_NAME> {                                     \
 /* END call internal function trait macro */
 
 template <any_stored_value_type value_type, class... Traits>
-struct func_table : trait_impl<Traits>::template func_impl<value_type>... {
+struct func_table : trait_impl<Traits>::template func_impl<value_type>...,
+                    instrumented_type {
 
   template <typename T>
   constexpr func_table(detail::type_t<T> t)
-      : trait_impl<Traits>::template func_impl<value_type>(t)... {}
+      : trait_impl<Traits>::template func_impl<value_type>(t)...,
+        instrumented_type(t), t_info(&typeid(T)) {}
+
+  // table of a narrower trait set for the type stored with wide
+  template <class... WideTraits>
+  explicit func_table(const func_table<value_type, WideTraits...> &wide)
+      : trait_impl<Traits>::template func_impl<value_type>(wide)...,
+        instrumented_type(wide), t_info(wide.t_info) {}
+
+  const std::type_info *t_info;
 };
 
 template <typename T, any_stored_value_type value_type, class... Traits>
@@ -602,6 +1056,251 @@ template <typename T, any_stored_value_type value_type, class... Traits>
 constexpr func_table<value_type, Traits...>
     func_table_instance<T, value_type, Traits...>::value;
 
+#ifdef AWT_ENABLE_INSTRUMENTATION
+// counts an event of a value stored with f_table, allocations of heap values
+// add their size to heap bytes
+template <any_stored_value_type value_type, class... Traits>
+void count_value(counter_slot slot,
+                 const func_table<value_type, Traits...> *f_table,
+                 bool allocates) {
+  const instrumented_type &type = *f_table;
+  auto id = type.counted_id();
+  thread_counters::add(id, slot, 1);
+  if (allocates && value_type == any_stored_value_type::large)
+    thread_counters::add(id, heap_bytes_slot, type.value_size);
+  if (allocates && value_type == any_stored_value_type::shared)
+    thread_counters::add(id, heap_bytes_slot,
+                         shared_block::header_size + type.value_size);
+}
+
+template <any_stored_value_type value_type, class... Traits>
+void count_construction(const func_table<value_type, Traits...> *f_table) {
+  count_value(value_type == any_stored_value_type::small
+                  ? small_constructions_slot
+                  : value_type == any_stored_value_type::stateless
+                        ? stateless_constructions_slot
+                        : heap_constructions_slot,
+              f_table, true);
+}
+#endif
+
+// Tables of Narrow made from tables of Wide when an any is converted, the
+// stored type is not known statically there. Only conversions a program makes
+// cost anything. One table is made per table of Wide and never freed, they
+// are kept in a list which is only prepended to, so lookups take no lock.
+template <class Narrow, class Wide> class narrowed_func_table {
+  struct node {
+    const Wide *wide;
+    Narrow table;
+    node *next;
+  };
+
+public:
+  static const Narrow *get(const Wide *wide) {
+    static thread_local const Wide *last_wide = nullptr;
+    static thread_local const Narrow *last = nullptr;
+    if (wide == last_wide)
+      return last;
+    auto first = head().load(std::memory_order_acquire);
+    auto found = find(wide, first, nullptr);
+    if (!found) {
+      std::unique_ptr<node> made(new node{wide, Narrow(*wide), first});
+      while (!head().compare_exchange_weak(made->next, made.get(),
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_acquire)) {
+        // another thread may have added the same table meanwhile, only nodes
+        // added since the last search are searched
+        if ((found = find(wide, made->next, first)))
+          break;
+        first = made->next;
+      }
+      if (!found)
+        found = made.release();
+    }
+    last_wide = wide;
+    last = &found->table;
+    return last;
+  }
+
+private:
+  static node *find(const Wide *wide, node *first, node *last) {
+    for (auto n = first; n != last; n = n->next)
+      if (n->wide == wide)
+        return n;
+    return nullptr;
+  }
+
+  static std::atomic<node *> &head() {
+    static std::atomic<node *> result{nullptr};
+    return result;
+  }
+};
+
+// Wide has every trait of Narrow in any order and the same storage layout,
+// so its values can be taken over by Narrow as they are
+template <class Narrow, class Wide> struct is_narrowing : std::false_type {};
+template <class... NarrowTraits, class... WideTraits>
+struct is_narrowing<any_t<NarrowTraits...>, any_t<WideTraits...>>
+    : std::integral_constant<
+          bool,
+          !std::is_same<any_t<NarrowTraits...>, any_t<WideTraits...>>::value &&
+              tmp::static_and<
+                  tmp::one_of<NarrowTraits, WideTraits...>::value...>::value &&
+              tmp::one_of<any_trait::heap_only, NarrowTraits...>::value ==
+                  tmp::one_of<any_trait::heap_only, WideTraits...>::value &&
+              tmp::one_of<any_trait::shared_storage, NarrowTraits...>::value ==
+                  tmp::one_of<any_trait::shared_storage,
+                              WideTraits...>::value> {};
+
+/* BEGIN any storage layouts */
+// default layout: small values are placed inside the any, large ones go to
+// the heap, owned by the any (large) or shared by its copies (shared)
+template <any_stored_value_type heap_value_type, class... Traits>
+struct basic_inline_any_data {
+  template <typename T>
+  using stored_value_type_for = std::integral_constant<
+      any_stored_value_type,
+      get_any_stored_value_type<T>::value == any_stored_value_type::large
+          ? heap_value_type
+          : get_any_stored_value_type<T>::value>;
+
+  static constexpr bool can_share =
+      heap_value_type == any_stored_value_type::shared;
+
+  struct {
+    union {
+      const func_table<any_stored_value_type::small, Traits...>
+          *small_f_table = nullptr;
+      const func_table<heap_value_type, Traits...> *heap_f_table;
+      const func_table<any_stored_value_type::stateless, Traits...>
+          *stateless_f_table;
+    };
+    const std::type_info *t_info = nullptr;
+    any_stored_value_type stored_value_type = heap_value_type;
+    void clear() {
+      small_f_table = nullptr;
+      t_info = nullptr;
+      stored_value_type = heap_value_type; // shouldn't matter
+    }
+  } type_data;
+  union {
+    void *data = nullptr;
+    char small_data[detail::any_small_size];
+  };
+
+  void set_f_table(
+      const func_table<any_stored_value_type::small, Traits...> *f_table) {
+    type_data.small_f_table = f_table;
+    type_data.t_info = f_table->t_info;
+    type_data.stored_value_type = any_stored_value_type::small;
+  }
+
+  void set_f_table(const func_table<heap_value_type, Traits...> *f_table) {
+    type_data.heap_f_table = f_table;
+    type_data.t_info = f_table->t_info;
+    type_data.stored_value_type = heap_value_type;
+  }
+
+  void set_f_table(
+      const func_table<any_stored_value_type::stateless, Traits...> *f_table) {
+    type_data.stateless_f_table = f_table;
+    type_data.t_info = f_table->t_info;
+    type_data.stored_value_type = any_stored_value_type::stateless;
+  }
+
+  const std::type_info *type_info() const { return type_data.t_info; }
+
+  // value is shared with another any
+  bool is_shared() const {
+    return can_share && type_data.t_info &&
+           type_data.stored_value_type == any_stored_value_type::shared &&
+           !shared_block::is_unique(data);
+  }
+
+  const void *f_table_ptr() const {
+    return visit_ftable([](const void *f_table) { return f_table; });
+  }
+
+  void *data_ptr() {
+    switch (type_data.stored_value_type) {
+    case any_stored_value_type::small:
+    case any_stored_value_type::stateless:
+      return &small_data;
+    default:
+      return data;
+    }
+  }
+
+  template <class VisitorType>
+  auto visit_ftable(const VisitorType &visitor) const noexcept {
+    switch (type_data.stored_value_type) {
+    case any_stored_value_type::small:
+      return visitor(type_data.small_f_table);
+    case any_stored_value_type::stateless:
+      return visitor(type_data.stateless_f_table);
+    default:
+      return visitor(type_data.heap_f_table);
+    }
+  }
+};
+
+template <class... Traits>
+using inline_any_data =
+    basic_inline_any_data<any_stored_value_type::large, Traits...>;
+
+// any_trait::shared_storage layout
+template <class... Traits>
+using shared_any_data =
+    basic_inline_any_data<any_stored_value_type::shared, Traits...>;
+
+// any_trait::heap_only layout: table pointer plus data pointer, type info is
+// taken from the table and there is nothing to branch on
+template <class... Traits> struct heap_any_data {
+  template <typename T>
+  using stored_value_type_for =
+      std::integral_constant<any_stored_value_type,
+                             any_stored_value_type::large>;
+
+  static constexpr bool can_share = false;
+
+  struct {
+    const func_table<any_stored_value_type::large, Traits...> *large_f_table =
+        nullptr;
+    void clear() { large_f_table = nullptr; }
+  } type_data;
+  void *data = nullptr;
+
+  void set_f_table(
+      const func_table<any_stored_value_type::large, Traits...> *f_table) {
+    type_data.large_f_table = f_table;
+  }
+
+  const std::type_info *type_info() const {
+    return type_data.large_f_table ? type_data.large_f_table->t_info
+                                   : nullptr;
+  }
+
+  bool is_shared() const { return false; }
+
+  void *data_ptr() { return data; }
+
+  const void *f_table_ptr() const { return type_data.large_f_table; }
+
+  template <class VisitorType>
+  auto visit_ftable(const VisitorType &visitor) const noexcept {
+    return visitor(type_data.large_f_table);
+  }
+};
+
+template <class... Traits>
+using any_data = std::conditional_t<
+    tmp::one_of<any_trait::heap_only, Traits...>::value,
+    heap_any_data<Traits...>,
+    std::conditional_t<tmp::one_of<any_trait::shared_storage, Traits...>::value,
+                       shared_any_data<Traits...>,
+                       inline_any_data<Traits...>>>;
+/* END any storage layouts */
+
 template <class... Traits>
 class any_t
     : public trait_impl<Traits>::template any_base<any_t<Traits...>>... {
@@ -610,16 +1309,56 @@ class any_t
       detail::tmp::one_of<any_trait::copiable, Traits...>::value;
   constexpr static bool is_movable =
       detail::tmp::one_of<any_trait::movable, Traits...>::value;
+  using data_t = detail::any_data<Traits...>;
+
+  // anys with a superset of traits are converted rather than stored
+  template <typename Type>
+  using enable_if_value_t =
+      std::enable_if_t<!std::is_same<std::decay_t<Type>, self>::value &&
+                           !is_narrowing<self, std::decay_t<Type>>::value,
+                       int>;
+  template <typename Other>
+  using enable_if_narrowing_t =
+      std::enable_if_t<is_narrowing<self, Other>::value, int>;
 
 public:
   any_t() noexcept {}
-  template <
-      typename Type,
-      std::enable_if_t<!std::is_same<std::decay_t<Type>, self>::value, int> = 0>
+  template <typename Type, enable_if_value_t<Type> = 0>
   any_t(Type &&value) noexcept {
     *this = std::forward<Type>(value);
   }
 
+  // takes over the value of an any with more traits: no copy or allocation,
+  // small values are relocated, only the func table is replaced. Traits may
+  // come in any order, but anys with the same traits in different order are
+  // still distinct types with distinct tables, trait order is not
+  // canonicalized.
+  template <class... WideTraits,
+            enable_if_narrowing_t<any_t<WideTraits...>> = 0>
+  any_t(any_t<WideTraits...> &&other) noexcept {
+    take_over(other);
+  }
+  template <class... WideTraits,
+            enable_if_narrowing_t<any_t<WideTraits...>> = 0>
+  any_t(const any_t<WideTraits...> &other) {
+    take_over(any_t<WideTraits...>(other));
+  }
+  template <class... WideTraits,
+            enable_if_narrowing_t<any_t<WideTraits...>> = 0>
+  self &operator=(any_t<WideTraits...> &&other) noexcept {
+    this->~any_t();
+    take_over(other);
+    return *this;
+  }
+  template <class... WideTraits,
+            enable_if_narrowing_t<any_t<WideTraits...>> = 0>
+  self &operator=(const any_t<WideTraits...> &other) {
+    any_t<WideTraits...> copy(other);
+    this->~any_t();
+    take_over(copy);
+    return *this;
+  }
+
   template <class ValueType, class... Args>
   auto emplace(Args &&... args)
       -> tmp::void_t<std::is_constructible<std::decay_t<ValueType>, Args...>> {
@@ -633,43 +1372,120 @@ public:
     *this = std::decay_t<ValueType>(il, std::forward<Args>(args)...);
   }
 
-  template <
-      typename Type,
-      std::enable_if_t<!std::is_same<std::decay_t<Type>, self>::value, int> = 0>
+  // takes ownership of a heap allocated value. Values stored on the heap by
+  // this any are kept where they are, others are moved into it
+  template <typename T> void adopt(std::unique_ptr<T> value) {
+    static_assert(!std::is_array<T>::value && !std::is_const<T>::value,
+                  "single non-const object is expected");
+    this->~any_t();
+    if (!value)
+      return;
+    using t = typename data_t::template stored_value_type_for<T>;
+    adopt_ptr(t(), value);
+  }
+
+  // ownership of the value if it is a T, nullptr otherwise. Values owned on
+  // the heap are handed over as they are, others are moved to a new object
+  template <typename T> std::unique_ptr<T> release() {
+    if (!cast<T>())
+      return nullptr;
+    using t = typename data_t::template stored_value_type_for<T>;
+    return release_ptr<T>(t());
+  }
+
+  template <typename Type, enable_if_value_t<Type> = 0>
   self &operator=(Type &&value) noexcept {
     using decayed_type = std::decay_t<Type>;
     static_assert(!std::is_base_of<decayed_type, self>::value,
                   "Possible error in traits implementation");
-    self::~any_t();
-    d.type_data.t_info = &typeid(decayed_type);
-    using t = detail::get_any_stored_value_type<decayed_type>;
-    d.type_data.stored_value_type = t::value;
+    this->~any_t();
+    using t = typename data_t::template stored_value_type_for<decayed_type>;
     dispatch_and_fill(t(), std::forward<Type>(value));
     return *this;
   }
 
   template <typename Type>
   void dispatch_and_fill(std::integral_constant<any_stored_value_type,
-                                                any_stored_value_type::small>
-                             c,
+                                                any_stored_value_type::small>,
                          Type &&value) noexcept {
     using decayed_type = std::decay_t<Type>;
-    d.type_data.small_f_table =
+    d.set_f_table(
         &detail::func_table_instance<decayed_type, any_stored_value_type::small,
-                                     Traits...>::value;
+                                     Traits...>::value);
     new (d.small_data) decayed_type(std::forward<Type>(value));
+    AWT_DETAIL_INSTRUMENT(count_construction();)
   }
 
   template <typename Type>
   void dispatch_and_fill(std::integral_constant<any_stored_value_type,
-                                                any_stored_value_type::large>
-                             c,
+                                                any_stored_value_type::large>,
                          Type &&value) {
     using decayed_type = std::decay_t<Type>;
-    d.type_data.large_f_table =
+    d.set_f_table(
         &detail::func_table_instance<decayed_type, any_stored_value_type::large,
-                                     Traits...>::value;
+                                     Traits...>::value);
     d.data = new decayed_type(std::forward<Type>(value));
+    AWT_DETAIL_INSTRUMENT(count_construction();)
+  }
+
+  template <typename Type>
+  void dispatch_and_fill(std::integral_constant<any_stored_value_type,
+                                                any_stored_value_type::shared>,
+                         Type &&value) {
+    using decayed_type = std::decay_t<Type>;
+    d.set_f_table(
+        &detail::func_table_instance<decayed_type,
+                                     any_stored_value_type::shared,
+                                     Traits...>::value);
+    d.data = shared_block::make<decayed_type>(std::forward<Type>(value));
+    AWT_DETAIL_INSTRUMENT(count_construction();)
+  }
+
+  template <typename Type>
+  void dispatch_and_fill(
+      std::integral_constant<any_stored_value_type,
+                             any_stored_value_type::stateless>,
+      Type &&) noexcept {
+    using decayed_type = std::decay_t<Type>;
+    d.set_f_table(&detail::func_table_instance<
+                  decayed_type, any_stored_value_type::stateless,
+                  Traits...>::value);
+    AWT_DETAIL_INSTRUMENT(count_construction();)
+  }
+
+  template <typename T>
+  void adopt_ptr(std::integral_constant<any_stored_value_type,
+                                        any_stored_value_type::large>,
+                 std::unique_ptr<T> &value) noexcept {
+    d.set_f_table(&detail::func_table_instance<T, any_stored_value_type::large,
+                                               Traits...>::value);
+    d.data = value.release();
+    AWT_DETAIL_INSTRUMENT(count_construction();)
+  }
+
+  template <typename T, any_stored_value_type value_type>
+  void adopt_ptr(std::integral_constant<any_stored_value_type, value_type> t,
+                 std::unique_ptr<T> &value) {
+    dispatch_and_fill(t, std::move(*value));
+  }
+
+  template <typename T>
+  std::unique_ptr<T> release_ptr(
+      std::integral_constant<any_stored_value_type,
+                             any_stored_value_type::large>) noexcept {
+    AWT_DETAIL_INSTRUMENT(count(destructions_slot);)
+    std::unique_ptr<T> result(static_cast<T *>(d.data));
+    d.type_data.clear();
+    return result;
+  }
+
+  template <typename T, any_stored_value_type value_type>
+  std::unique_ptr<T>
+  release_ptr(std::integral_constant<any_stored_value_type, value_type>) {
+    auto result = std::make_unique<T>(
+        std::move(*static_cast<T *>(mutable_data_ptr())));
+    reset();
+    return result;
   }
 
   any_t(const self &other) {
@@ -698,8 +1514,8 @@ public:
     this->move_from(std::move(other));
     return *this;
   }
-  const std::type_info &type() const { return *d.type_data.t_info; }
-  bool has_value() const { return d.type_data.t_info != nullptr; }
+  const std::type_info &type() const { return *d.type_info(); }
+  bool has_value() const { return d.type_info() != nullptr; }
   void reset() { this->~self(); }
   void swap(self &other) noexcept {
     using std::swap;
@@ -726,74 +1542,286 @@ private:
     if (!has_value())
       return nullptr;
 
-    if (*d.type_data.t_info == typeid(std::remove_const_t<Type>))
+    if (*d.type_info() == typeid(std::remove_const_t<Type>))
       return static_cast<Type *>(data_ptr());
 
     return nullptr;
   }
 
-  void *data_ptr() {
-    switch (d.type_data.stored_value_type) {
-    case any_stored_value_type::large:
-      return d.data;
-    case any_stored_value_type::small:
-      return &d.small_data;
-    }
-    return nullptr;
+  template <typename Type> Type *mutable_cast() {
+    if (!cast<Type>())
+      return nullptr;
+    return static_cast<Type *>(mutable_data_ptr());
   }
 
+  void *data_ptr() { return d.data_ptr(); }
+
   void *data_ptr() const {
     return (const_cast<self *>(this))->data_ptr();
   }
 
+  // copy-on-write, only copies can share a value
+  void *mutable_data_ptr() {
+    unshare(std::integral_constant<bool, is_copiable && data_t::can_share>());
+    return data_ptr();
+  }
+
+  void unshare(std::false_type) {}
+  void unshare(std::true_type) {
+    if (!d.is_shared())
+      return;
+    auto f_table = d.type_data.heap_f_table;
+    auto copy = f_table->call_clone(d.data);
+    f_table->call_dtor(d.data);
+    d.data = copy;
+    AWT_DETAIL_INSTRUMENT(count(clones_slot, true); count(destructions_slot);)
+  }
+
+#ifdef AWT_ENABLE_INSTRUMENTATION
+  // event of the stored value if there is one, allocates if a heap value was
+  // allocated for it
+  void count(counter_slot slot, bool allocates = false) const {
+    if (!has_value())
+      return;
+    visit_ftable(
+        [&](auto f_table) { detail::count_value(slot, f_table, allocates); });
+  }
+
+  void count_construction() const {
+    visit_ftable([](auto f_table) { detail::count_construction(f_table); });
+  }
+#endif
+
   template <class VisitorType>
   auto visit_ftable(const VisitorType &visitor) const noexcept {
-    switch (d.type_data.stored_value_type) {
-    case any_stored_value_type::small:
-      return visitor(d.type_data.small_f_table);
-      break;
-    case any_stored_value_type::large:
-      return visitor(d.type_data.large_f_table);
-      break;
-    }
-    abort();
+    return d.visit_ftable(visitor);
+  }
+
+  // default constructed T in place of the current value
+  template <typename T> T &construct() {
+    this->~any_t();
+    using t = typename data_t::template stored_value_type_for<T>;
+    return *construct_value<T>(t());
+  }
+
+  template <typename T>
+  T *construct_value(std::integral_constant<any_stored_value_type,
+                                            any_stored_value_type::small>) {
+    auto value = new (d.small_data) T();
+    d.set_f_table(&detail::func_table_instance<T, any_stored_value_type::small,
+                                               Traits...>::value);
+    AWT_DETAIL_INSTRUMENT(count_construction();)
+    return value;
+  }
+
+  template <typename T>
+  T *construct_value(std::integral_constant<any_stored_value_type,
+                                            any_stored_value_type::large>) {
+    auto value = new T();
+    d.set_f_table(&detail::func_table_instance<T, any_stored_value_type::large,
+                                               Traits...>::value);
+    d.data = value;
+    AWT_DETAIL_INSTRUMENT(count_construction();)
+    return value;
+  }
+
+  template <typename T>
+  T *construct_value(std::integral_constant<any_stored_value_type,
+                                            any_stored_value_type::shared>) {
+    auto value = shared_block::make<T>();
+    d.set_f_table(&detail::func_table_instance<
+                  T, any_stored_value_type::shared, Traits...>::value);
+    d.data = value;
+    AWT_DETAIL_INSTRUMENT(count_construction();)
+    return value;
+  }
+
+  template <typename T>
+  T *construct_value(std::integral_constant<any_stored_value_type,
+                                            any_stored_value_type::stateless>) {
+    d.set_f_table(&detail::func_table_instance<
+                  T, any_stored_value_type::stateless, Traits...>::value);
+    AWT_DETAIL_INSTRUMENT(count_construction();)
+    return reinterpret_cast<T *>(d.small_data);
+  }
+
+  // other is left empty
+  template <class... WideTraits> void take_over(any_t<WideTraits...> &&other) {
+    take_over(other);
+  }
+  template <class... WideTraits> void take_over(any_t<WideTraits...> &other) {
+    static_assert(tmp::one_of<any_trait::movable, WideTraits...>::value,
+                  "conversion requires movable trait in the source any");
+    if (!other.has_value())
+      return;
+    other.visit_ftable(
+        [&](auto f_table) { this->take_over_value(f_table, other); });
+    other.d.type_data.clear();
+    AWT_DETAIL_INSTRUMENT(count(moves_slot);)
+  }
+
+  template <class... WideTraits>
+  void take_over_value(
+      const func_table<any_stored_value_type::small, WideTraits...> *wide,
+      any_t<WideTraits...> &other) {
+    d.set_f_table(narrowed(wide));
+    const trait_impl<any_trait::movable>::func_impl<
+        any_stored_value_type::small> &mover = *wide;
+    if (mover.call_move)
+      mover.call_move(d.small_data, other.d.small_data);
+    else
+      std::memcpy(d.small_data, other.d.small_data, detail::any_small_size);
+  }
+
+  template <class... WideTraits>
+  void take_over_value(
+      const func_table<any_stored_value_type::stateless, WideTraits...> *wide,
+      any_t<WideTraits...> &) {
+    d.set_f_table(narrowed(wide));
+  }
+
+  // large and shared values, the pointer is taken over
+  template <any_stored_value_type value_type, class... WideTraits>
+  void take_over_value(const func_table<value_type, WideTraits...> *wide,
+                       any_t<WideTraits...> &other) {
+    d.set_f_table(narrowed(wide));
+    d.data = other.d.data;
+  }
+
+  template <any_stored_value_type value_type, class... WideTraits>
+  static const func_table<value_type, Traits...> *
+  narrowed(const func_table<value_type, WideTraits...> *wide) {
+    return narrowed_func_table<func_table<value_type, Traits...>,
+                               func_table<value_type, WideTraits...>>::get(wide);
   }
 
 private:
-  struct {
-    struct {
-      union {
-        const func_table<any_stored_value_type::small, Traits...>
-            *small_f_table = nullptr;
-        const func_table<any_stored_value_type::large, Traits...>
-            *large_f_table;
-      };
-      const std::type_info *t_info = nullptr;
-      any_stored_value_type stored_value_type = any_stored_value_type::large;
-      void clear() {
-        small_f_table = nullptr;
-        t_info = nullptr;
-        stored_value_type = any_stored_value_type::large; // shouldn't matter
-      }
-    } type_data;
-    union {
-      void *data = nullptr;
-      char small_data[detail::any_small_size];
-    };
-  } d;
+  data_t d;
 
+  template <class... OtherTraits> friend class any_t;
   template <class T> friend struct trait_impl;
+  friend struct any_access;
   template <typename Type, typename... Traits1>
   friend Type *awt::any_cast(awt::any<Traits1...> *value);
   template <typename Type, typename... Traits1>
   friend const Type *awt::any_cast(const awt::any<Traits1...> *value);
 };
+
+// internals for algorithms and containers operating on anys directly
+struct any_access {
+  // address of small buffer or data pointer, whichever is in use
+  template <class... Traits> static void *storage(const any_t<Traits...> &value) {
+    return const_cast<void *>(static_cast<const void *>(&value.d.data));
+  }
+
+  // distinct for every stored type and storage kind, nullptr for empty any
+  template <class... Traits>
+  static const void *f_table(const any_t<Traits...> &value) {
+    return value.d.f_table_ptr();
+  }
+
+  template <class... Traits> static void *data_ptr(const any_t<Traits...> &value) {
+    return value.data_ptr();
+  }
+
+  // for modification, a value shared with other anys is copied first
+  template <class... Traits>
+  static void *mutable_data_ptr(any_t<Traits...> &value) {
+    return value.mutable_data_ptr();
+  }
+
+  // replaces the value with a default constructed T, constructed in place
+  template <typename T, class... Traits>
+  static T &construct(any_t<Traits...> &value) {
+    return value.template construct<T>();
+  }
+
+  // value of a non-empty any known to hold T, type is not checked
+  template <typename T, class... Traits>
+  static const T &value(const any_t<Traits...> &value) {
+    using data_t = typename any_t<Traits...>::data_t;
+    using t = typename data_t::template stored_value_type_for<T>;
+    return stored_value_access<t::value>::template get<T>(storage(value));
+  }
+
+  template <class VisitorType, class... Traits>
+  static auto visit_ftable(const any_t<Traits...> &value,
+                           const VisitorType &visitor) {
+    return value.visit_ftable(visitor);
+  }
+};
+
+// func table part of a single trait
+template <class Trait, any_stored_value_type value_type, class... Traits>
+const typename trait_impl<Trait>::template func_impl<value_type> *
+trait_f_table(const func_table<value_type, Traits...> *f_table) {
+  return f_table;
+}
+
+// value management traits make no sense for a reference
+template <class Trait, class RealType> struct any_ref_base {
+  using type = typename trait_impl<Trait>::template any_base<RealType>;
+};
+template <class Trait> struct empty_any_ref_base {};
+template <class RealType>
+struct any_ref_base<any_trait::destructible, RealType> {
+  using type = empty_any_ref_base<any_trait::destructible>;
+};
+template <class RealType> struct any_ref_base<any_trait::copiable, RealType> {
+  using type = empty_any_ref_base<any_trait::copiable>;
+};
+template <class RealType> struct any_ref_base<any_trait::movable, RealType> {
+  using type = empty_any_ref_base<any_trait::movable>;
+};
+
+template <class... Traits>
+class any_ref_t
+    : public any_ref_base<Traits, any_ref_t<Traits...>>::type... {
+public:
+  using f_table_t = func_table<any_stored_value_type::small, Traits...>;
+
+  any_ref_t() noexcept {}
+  // object is expected to be constructed in place, i.e. the way small values
+  // are stored
+  any_ref_t(const f_table_t *f_table, void *object) noexcept
+      : f_table(f_table), object(object) {}
+
+  template <typename T> static any_ref_t make(T &value) noexcept {
+    return {&func_table_instance<T, any_stored_value_type::small,
+                                 Traits...>::value,
+            &value};
+  }
+
+  const std::type_info &type() const { return *f_table->t_info; }
+  bool has_value() const { return f_table != nullptr; }
+
+  template <typename Type> Type *cast() const {
+    if (has_value() && type() == typeid(std::remove_const_t<Type>))
+      return static_cast<Type *>(object);
+    return nullptr;
+  }
+
+private:
+  void *data_ptr() const { return object; }
+  void *mutable_data_ptr() const { return object; }
+
+  template <class VisitorType>
+  auto visit_ftable(const VisitorType &visitor) const noexcept {
+    return visitor(f_table);
+  }
+
+  const f_table_t *f_table = nullptr;
+  void *object = nullptr;
+
+  template <class T> friend struct trait_impl;
+};
 } // namespace detail
 
+// a value shared with other anys is copied first
 template <typename Type, typename... Traits>
 Type *any_cast(any<Traits...> *value) {
   if (value)
-    return value->template cast<Type>();
+    return value->template mutable_cast<Type>();
 
   return nullptr;
 }
@@ -823,6 +1851,23 @@ const Type &any_cast(const any<Traits...> &value) {
 
   throw std::bad_cast{}; // technically should be bad_any_cast
 }
+
+template <typename Type, typename... Traits>
+Type *any_cast(const any_ref<Traits...> *value) {
+  if (value)
+    return value->template cast<Type>();
+
+  return nullptr;
+}
+
+template <typename Type, typename... Traits>
+Type &any_cast(const any_ref<Traits...> &value) {
+  auto ptr = any_cast<Type>(&value);
+  if (ptr)
+    return *ptr;
+
+  throw std::bad_cast{}; // technically should be bad_any_cast
+}
 } // namespace awt
 
 namespace std {
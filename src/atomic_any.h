@@ -0,0 +1,289 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace awt {
+namespace detail {
+// Hazard pointers: a reader publishes the pointer it is about to use in its
+// record, retired objects are deleted only when no record holds them.
+class hazard_domain {
+public:
+  struct record {
+    std::atomic<const void *> hazard{nullptr};
+    std::atomic<bool> active{false};
+    record *next = nullptr;
+  };
+
+  // never destroyed, threads may outlive static objects
+  static hazard_domain &instance() {
+    static auto domain = new hazard_domain();
+    return *domain;
+  }
+
+  // record owned by the caller until release
+  record *acquire() {
+    auto &cache = thread_cache();
+    if (cache.free) {
+      auto result = cache.free;
+      cache.free = nullptr;
+      return result;
+    }
+    for (auto r = head.load(std::memory_order_acquire); r; r = r->next) {
+      bool expected = false;
+      if (!r->active.load(std::memory_order_relaxed) &&
+          r->active.compare_exchange_strong(expected, true,
+                                            std::memory_order_acquire))
+        return r;
+    }
+    auto r = new record();
+    r->active.store(true, std::memory_order_relaxed);
+    auto old_head = head.load(std::memory_order_relaxed);
+    do
+      r->next = old_head;
+    while (!head.compare_exchange_weak(old_head, r, std::memory_order_release,
+                                       std::memory_order_relaxed));
+    record_count.fetch_add(1, std::memory_order_relaxed);
+    return r;
+  }
+
+  void release(record *r) {
+    r->hazard.store(nullptr, std::memory_order_release);
+    auto &cache = thread_cache();
+    if (!cache.free)
+      cache.free = r;
+    else
+      r->active.store(false, std::memory_order_release);
+  }
+
+  // deleter is called once no hazard points to object
+  void retire(void *object, void (*deleter)(void *)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    retired.push_back({object, deleter});
+    if (retired.size() >= 2 * record_count.load() + 16)
+      reclaim_locked();
+  }
+
+  void reclaim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    reclaim_locked();
+  }
+
+private:
+  struct retired_object {
+    void *object;
+    void (*deleter)(void *);
+  };
+
+  // a thread keeps one record for itself, given back when the thread exits
+  struct thread_records {
+    record *free = nullptr;
+    ~thread_records() {
+      if (free)
+        free->active.store(false, std::memory_order_release);
+    }
+  };
+
+  static thread_records &thread_cache() {
+    static thread_local thread_records records;
+    return records;
+  }
+
+  void reclaim_locked() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::vector<const void *> hazards;
+    for (auto r = head.load(std::memory_order_acquire); r; r = r->next)
+      if (auto h = r->hazard.load(std::memory_order_acquire))
+        hazards.push_back(h);
+    std::sort(hazards.begin(), hazards.end());
+    auto protected_end = std::partition(
+        retired.begin(), retired.end(), [&](const retired_object &r) {
+          return std::binary_search(hazards.begin(), hazards.end(),
+                                    static_cast<const void *>(r.object));
+        });
+    std::vector<retired_object> unused(protected_end, retired.end());
+    retired.erase(protected_end, retired.end());
+    for (auto &r : unused)
+      r.deleter(r.object);
+  }
+
+  std::atomic<record *> head{nullptr};
+  std::atomic<std::size_t> record_count{0};
+  std::mutex mutex;
+  std::vector<retired_object> retired;
+};
+
+template <class... Traits> class atomic_shared_any_t;
+} // namespace detail
+
+// Holder of an immutable any which can be read and replaced concurrently.
+// Readers get either a guard (hazard pointer, the shared reference count is
+// not touched, for short reads) or a shared handle (reference counted, may be
+// kept for long). Replaced values are destroyed once the last guard and
+// handle referring to them are gone.
+template <class... Traits>
+using atomic_shared_any =
+    detail::atomic_shared_any_t<any_trait::destructible, Traits...>;
+
+namespace detail {
+template <class... Traits> class atomic_shared_any_t {
+public:
+  using value_type = any_t<Traits...>;
+
+private:
+  struct node {
+    template <class... Args>
+    explicit node(Args &&... args) : value(std::forward<Args>(args)...) {}
+
+    std::atomic<std::size_t> refs{1};
+    const value_type value;
+  };
+
+  static void destroy(void *object) { delete static_cast<node *>(object); }
+
+  static void add_ref(node *n) {
+    n->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // fails if the node is being retired already
+  static bool add_ref_if_alive(node *n) {
+    auto refs = n->refs.load(std::memory_order_relaxed);
+    do
+      if (refs == 0)
+        return false;
+    while (!n->refs.compare_exchange_weak(refs, refs + 1,
+                                          std::memory_order_relaxed));
+    return true;
+  }
+
+  static void release(node *n) {
+    if (n && n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      hazard_domain::instance().retire(n, &destroy);
+  }
+
+public:
+  // reference counted handle to a published value
+  class shared {
+  public:
+    shared() = default;
+    shared(const shared &other) : n(other.n) {
+      if (n)
+        add_ref(n);
+    }
+    shared(shared &&other) noexcept : n(std::exchange(other.n, nullptr)) {}
+    shared &operator=(shared other) noexcept {
+      std::swap(n, other.n);
+      return *this;
+    }
+    ~shared() { release(n); }
+
+    explicit operator bool() const { return n != nullptr; }
+    const value_type &operator*() const { return n->value; }
+    const value_type *operator->() const { return &n->value; }
+    const value_type *get() const { return n ? &n->value : nullptr; }
+
+  private:
+    explicit shared(node *n) : n(n) {}
+
+    node *n = nullptr;
+
+    friend class atomic_shared_any_t;
+  };
+
+  // hazard protected view of a published value, meant to be short lived
+  class guard {
+  public:
+    guard(guard &&other) noexcept
+        : r(std::exchange(other.r, nullptr)), n(other.n) {}
+    guard &operator=(guard &&) = delete;
+    ~guard() {
+      if (r)
+        hazard_domain::instance().release(r);
+    }
+
+    explicit operator bool() const { return n != nullptr; }
+    const value_type &operator*() const { return n->value; }
+    const value_type *operator->() const { return &n->value; }
+    const value_type *get() const { return n ? &n->value : nullptr; }
+
+  private:
+    guard(hazard_domain::record *r, node *n) : r(r), n(n) {}
+
+    hazard_domain::record *r;
+    node *n;
+
+    friend class atomic_shared_any_t;
+  };
+
+  atomic_shared_any_t() = default;
+  template <class Type, class = std::enable_if_t<!std::is_same<
+                            std::decay_t<Type>, atomic_shared_any_t>::value>>
+  explicit atomic_shared_any_t(Type &&value)
+      : current(new node(std::forward<Type>(value))) {}
+  atomic_shared_any_t(const atomic_shared_any_t &) = delete;
+  atomic_shared_any_t &operator=(const atomic_shared_any_t &) = delete;
+  ~atomic_shared_any_t() { release(current.load(std::memory_order_relaxed)); }
+
+  guard load() const {
+    auto r = hazard_domain::instance().acquire();
+    return {r, protect(r)};
+  }
+
+  shared load_shared() const {
+    auto &domain = hazard_domain::instance();
+    auto r = domain.acquire();
+    node *n;
+    do
+      n = protect(r);
+    while (n && !add_ref_if_alive(n));
+    domain.release(r);
+    return shared(n);
+  }
+
+  // publishes a new value constructed from given one
+  template <class Type, class = std::enable_if_t<
+                            !std::is_same<std::decay_t<Type>, shared>::value>>
+  void store(Type &&value) {
+    replace(new node(std::forward<Type>(value)));
+  }
+
+  // publishes value of a handle, e.g. one loaded from another atomic
+  void store(const shared &value) {
+    if (value.n)
+      add_ref(value.n);
+    replace(value.n);
+  }
+
+  void reset() { replace(nullptr); }
+
+  // destroys replaced values no reader uses anymore, happens automatically
+  // once enough of them are accumulated
+  static void reclaim() { hazard_domain::instance().reclaim(); }
+
+private:
+  node *protect(hazard_domain::record *r) const {
+    auto n = current.load(std::memory_order_acquire);
+    for (;;) {
+      r->hazard.store(n, std::memory_order_seq_cst);
+      auto again = current.load(std::memory_order_seq_cst);
+      if (again == n)
+        return n;
+      n = again;
+    }
+  }
+
+  void replace(node *n) {
+    release(current.exchange(n, std::memory_order_acq_rel));
+  }
+
+  std::atomic<node *> current{nullptr};
+};
+} // namespace detail
+} // namespace awt
@@ -0,0 +1,415 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#if !defined(__cpp_impl_coroutine)
+#error "coroutine.h requires C++20 coroutines (see AWT_ENABLE_COROUTINES)"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace any_trait {
+// value is an awaiter (await_ready, await_suspend, await_resume) giving T
+template <typename T> struct awaitable {};
+} // namespace any_trait
+
+namespace awt {
+// Monotonic arena for coroutine frames. While a scope is alive, frames of
+// awt::task created on its thread are cut from the arena, and freeing a frame
+// only decrements the number of live frames. Memory is reused after reset().
+class frame_arena {
+public:
+  explicit frame_arena(std::size_t chunk_size = 64 * 1024)
+      : chunk_size(chunk_size) {}
+  frame_arena(const frame_arena &) = delete;
+  frame_arena &operator=(const frame_arena &) = delete;
+  ~frame_arena() { assert(live_frames() == 0); }
+
+  // installs the arena for frames created on the current thread
+  class scope {
+  public:
+    explicit scope(frame_arena &arena) : previous(current()) {
+      current() = &arena;
+    }
+    scope(const scope &) = delete;
+    scope &operator=(const scope &) = delete;
+    ~scope() { current() = previous; }
+
+  private:
+    frame_arena *previous;
+  };
+
+  static frame_arena *&current() {
+    static thread_local frame_arena *arena = nullptr;
+    return arena;
+  }
+
+  void *allocate(std::size_t size) {
+    size = (size + alignment - 1) & ~(alignment - 1);
+    if (chunk_index == chunks.size() ||
+        offset + size > chunks[chunk_index].size)
+      next_chunk(size);
+    auto result = chunks[chunk_index].memory.get() + offset;
+    offset += size;
+    used += size;
+    live.fetch_add(1, std::memory_order_relaxed);
+    return result;
+  }
+
+  // may be called from any thread
+  void deallocate(void *) noexcept {
+    live.fetch_sub(1, std::memory_order_release);
+  }
+
+  std::size_t live_frames() const {
+    return live.load(std::memory_order_acquire);
+  }
+  std::size_t bytes_used() const { return used; }
+
+  // all frames have to be destroyed, chunks are kept for reuse
+  void reset() {
+    assert(live_frames() == 0);
+    chunk_index = 0;
+    offset = 0;
+    used = 0;
+  }
+
+private:
+  static constexpr std::size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+  struct chunk {
+    std::unique_ptr<char[]> memory;
+    std::size_t size;
+  };
+
+  void next_chunk(std::size_t size) {
+    if (!chunks.empty())
+      ++chunk_index;
+    while (chunk_index < chunks.size() && chunks[chunk_index].size < size)
+      ++chunk_index;
+    if (chunk_index == chunks.size()) {
+      auto new_size = std::max(size, chunk_size);
+      chunks.push_back(
+          {std::unique_ptr<char[]>(new char[new_size]), new_size});
+    }
+    offset = 0;
+  }
+
+  std::vector<chunk> chunks;
+  std::size_t chunk_size;
+  std::size_t chunk_index = 0;
+  std::size_t offset = 0;
+  std::size_t used = 0;
+  std::atomic<std::size_t> live{0};
+};
+
+namespace detail {
+// coroutine frames go to the arena of the creating thread if there is one,
+// header in front of the frame remembers where it came from
+struct frame_allocation {
+  static constexpr std::size_t header_size = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+  static void *operator new(std::size_t size) {
+    auto arena = frame_arena::current();
+    auto memory =
+        static_cast<char *>(arena ? arena->allocate(size + header_size)
+                                  : ::operator new(size + header_size));
+    *reinterpret_cast<frame_arena **>(memory) = arena;
+    return memory + header_size;
+  }
+
+  static void operator delete(void *frame) noexcept {
+    auto memory = static_cast<char *>(frame) - header_size;
+    if (auto arena = *reinterpret_cast<frame_arena **>(memory))
+      arena->deallocate(memory);
+    else
+      ::operator delete(memory);
+  }
+};
+
+// await_suspend may return void, bool or a coroutine handle, the result is
+// reduced to the coroutine to resume next
+template <class Awaiter>
+std::coroutine_handle<> suspend_awaiter(Awaiter &awaiter,
+                                        std::coroutine_handle<> awaiting) {
+  using result = decltype(awaiter.await_suspend(awaiting));
+  if constexpr (std::is_void_v<result>) {
+    awaiter.await_suspend(awaiting);
+    return std::noop_coroutine();
+  } else if constexpr (std::is_same_v<result, bool>) {
+    return awaiter.await_suspend(awaiting) ? std::noop_coroutine() : awaiting;
+  } else
+    return awaiter.await_suspend(awaiting);
+}
+
+/* BEGIN any_trait::awaitable implementation */
+template <typename Result> struct trait_impl<any_trait::awaitable<Result>> {
+  struct func_impl_base {
+    using ready_signature = bool (*)(void *);
+    using suspend_signature = std::coroutine_handle<> (*)(
+        void *, std::coroutine_handle<>);
+    using resume_signature = Result (*)(void *);
+
+    template <typename T> static bool ready(void *object) {
+      return static_cast<T *>(object)->await_ready();
+    }
+    template <typename T>
+    static std::coroutine_handle<> suspend(void *object,
+                                           std::coroutine_handle<> awaiting) {
+      return suspend_awaiter(*static_cast<T *>(object), awaiting);
+    }
+    template <typename T> static Result resume(void *object) {
+      return static_cast<T *>(object)->await_resume();
+    }
+
+    ready_signature call_await_ready = nullptr;
+    suspend_signature call_await_suspend = nullptr;
+    resume_signature call_await_resume = nullptr;
+
+    template <typename T>
+    constexpr func_impl_base(detail::type_t<T>)
+        : call_await_ready(&ready<T>), call_await_suspend(&suspend<T>),
+          call_await_resume(&resume<T>) {}
+  };
+
+  template <any_stored_value_type> struct func_impl : func_impl_base {
+    template <typename T>
+    constexpr func_impl(detail::type_t<T> t) : func_impl_base(t) {}
+  };
+
+  // any itself is an awaiter, every step is one indirect call made outside of
+  // visit_ftable so exceptions reach the coroutine
+  template <class RealType> struct any_base {
+    bool await_ready() const {
+      auto real_this = static_cast<const RealType *>(this);
+      assert(real_this->has_value());
+      return table()->call_await_ready(real_this->data_ptr());
+    }
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiting) const {
+      auto real_this = static_cast<const RealType *>(this);
+      return table()->call_await_suspend(real_this->data_ptr(), awaiting);
+    }
+    Result await_resume() const {
+      auto real_this = static_cast<const RealType *>(this);
+      return table()->call_await_resume(real_this->data_ptr());
+    }
+
+  private:
+    const func_impl_base *table() const {
+      return static_cast<const RealType *>(this)->visit_ftable(
+          [](const func_impl_base *f_table) { return f_table; });
+    }
+  };
+};
+/* END any_trait::awaitable implementation */
+
+template <class T> class task_promise;
+} // namespace detail
+
+// type erased awaiter, small awaiters are stored inline
+template <typename T>
+using any_awaitable = any<any_trait::movable, any_trait::awaitable<T>>;
+
+// Lazily started coroutine producing T. Awaiting it starts the coroutine and
+// resumes the awaiting one once it finishes.
+template <class T = void> class [[nodiscard]] task {
+public:
+  using promise_type = detail::task_promise<T>;
+
+  task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  task &operator=(task &&other) noexcept {
+    task(std::move(other)).swap(*this);
+    return *this;
+  }
+  ~task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  void swap(task &other) noexcept { std::swap(handle, other.handle); }
+
+  // a moved from task can't be awaited
+  bool await_ready() const noexcept {
+    assert(handle);
+    return handle.done();
+  }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    handle.promise().continuation = awaiting;
+    return handle;
+  }
+  T await_resume() { return handle.promise().result(); }
+
+private:
+  explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+
+  friend promise_type;
+};
+
+namespace detail {
+template <class T> class task_promise_base : public frame_allocation {
+public:
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <class Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> finished) noexcept {
+      return finished.promise().continuation;
+    }
+    void await_resume() noexcept {}
+  };
+  final_awaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() { error = std::current_exception(); }
+
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+
+protected:
+  void rethrow_if_failed() {
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  std::exception_ptr error;
+};
+
+template <class T> class task_promise : public task_promise_base<T> {
+public:
+  task<T> get_return_object() {
+    return task<T>(std::coroutine_handle<task_promise>::from_promise(*this));
+  }
+
+  template <class U> void return_value(U &&result) {
+    value.emplace(std::forward<U>(result));
+  }
+
+  T result() {
+    this->rethrow_if_failed();
+    return std::move(*value);
+  }
+
+private:
+  std::optional<T> value;
+};
+
+template <> class task_promise<void> : public task_promise_base<void> {
+public:
+  task<void> get_return_object() {
+    return task<void>(std::coroutine_handle<task_promise>::from_promise(*this));
+  }
+
+  void return_void() {}
+  void result() { rethrow_if_failed(); }
+};
+
+// coroutine used by sync_wait, signals an atomic flag when finished
+template <class T> class blocking_task {
+public:
+  struct promise_type : frame_allocation {
+    blocking_task get_return_object() {
+      return blocking_task(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<promise_type> finished) noexcept {
+        auto &done = finished.promise().done;
+        done.store(true, std::memory_order_release);
+        done.notify_one();
+      }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+    template <class U> void return_value(U &&result) {
+      value.emplace(std::forward<U>(result));
+    }
+
+    std::atomic<bool> done{false};
+    std::exception_ptr error;
+    std::optional<T> value;
+  };
+
+  blocking_task(blocking_task &&other) noexcept
+      : handle(std::exchange(other.handle, {})) {}
+  ~blocking_task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  T run() {
+    handle.resume();
+    handle.promise().done.wait(false, std::memory_order_acquire);
+    if (handle.promise().error)
+      std::rethrow_exception(handle.promise().error);
+    return std::move(*handle.promise().value);
+  }
+
+private:
+  explicit blocking_task(std::coroutine_handle<promise_type> handle)
+      : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+struct void_result {};
+
+template <class Awaitable>
+using await_result_t =
+    decltype(std::declval<Awaitable &>().await_resume());
+
+template <class Awaitable>
+blocking_task<std::conditional_t<std::is_void_v<await_result_t<Awaitable>>,
+                                 void_result, await_result_t<Awaitable>>>
+make_blocking_task(Awaitable &awaitable) {
+  if constexpr (std::is_void_v<await_result_t<Awaitable>>) {
+    co_await awaitable;
+    co_return void_result{};
+  } else
+    co_return co_await awaitable;
+}
+} // namespace detail
+
+// awaits on the current thread, blocks until awaitable is finished wherever it
+// is resumed
+template <class Awaitable>
+detail::await_result_t<Awaitable> sync_wait(Awaitable &&awaitable) {
+  auto blocking = detail::make_blocking_task(awaitable);
+  if constexpr (std::is_void_v<detail::await_result_t<Awaitable>>)
+    blocking.run();
+  else
+    return blocking.run();
+}
+
+// awaiter moving the coroutine to a thread of executor having post()
+template <class Executor> class resume_on {
+public:
+  explicit resume_on(Executor &executor) : executor(&executor) {}
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> awaiting) const {
+    executor->post([awaiting] { awaiting.resume(); });
+  }
+  void await_resume() const noexcept {}
+
+private:
+  Executor *executor;
+};
+} // namespace awt
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace awt {
+namespace detail {
+template <typename T, class F> struct typed_handler {
+  void operator()(void *value) const { f(*static_cast<T *>(value)); }
+
+  mutable F f;
+};
+
+template <class... Traits> class dispatcher_t {
+public:
+  using value_type = any_t<Traits...>;
+
+  // handler is called with T &, registering a type again replaces it
+  template <typename T, class F> void on(F &&handler) {
+    const std::type_info *type = &typeid(T);
+    handler_type wrapped =
+        typed_handler<T, std::decay_t<F>>{std::forward<F>(handler)};
+    auto it = index.find(*type);
+    if (it != index.end()) {
+      handlers[it->second] = std::move(wrapped);
+      return;
+    }
+    index.emplace(*type, handlers.size());
+    types.push_back(type);
+    handlers.push_back(std::move(wrapped));
+    rebuild_table();
+  }
+
+  // called with the message itself when no handler matches its type
+  template <class F> void otherwise(F &&handler) {
+    fallback = std::forward<F>(handler);
+  }
+
+  template <typename T> bool handles() const {
+    return index.count(typeid(T)) > 0;
+  }
+
+  std::size_t size() const { return handlers.size(); }
+
+  // false if it went to the fallback handler or nowhere
+  bool dispatch(value_type &message) const {
+    if (message.has_value()) {
+      auto i = find(message.type());
+      if (i < handlers.size()) {
+        handlers[i](any_access::mutable_data_ptr(message));
+        return true;
+      }
+    }
+    if (fallback.has_value())
+      fallback(message);
+    return false;
+  }
+
+  bool operator()(value_type &message) const { return dispatch(message); }
+
+private:
+  using handler_type = unique_function<void(void *)>;
+
+  std::size_t hash(const std::type_info *type) const {
+    return static_cast<std::size_t>(
+        (reinterpret_cast<std::uintptr_t>(type) * multiplier) >> shift);
+  }
+
+  // type_info objects are usually unique and are found by address with a
+  // single probe, duplicates (e.g. from shared libraries) are found by value
+  std::size_t find(const std::type_info &type) const {
+    auto slot = table[hash(&type)];
+    if (slot != 0 && types[slot - 1] == &type)
+      return slot - 1;
+    auto it = index.find(type);
+    return it != index.end() ? it->second : handlers.size();
+  }
+
+  // picks a multiplier for which registered addresses don't collide
+  void rebuild_table() {
+    std::size_t size = 2;
+    unsigned bits = 1;
+    while (size < 2 * types.size()) {
+      size *= 2;
+      ++bits;
+    }
+    for (;; size *= 2, ++bits) {
+      std::uint64_t candidate = 0x9e3779b97f4a7c15ull;
+      for (int attempt = 0; attempt < 32; ++attempt) {
+        candidate = (candidate * 0x5851f42d4c957f2dull + 1) | 1;
+        if (try_build(size, bits, candidate))
+          return;
+      }
+    }
+  }
+
+  bool try_build(std::size_t size, unsigned bits, std::uint64_t candidate) {
+    multiplier = candidate;
+    shift = 64 - bits;
+    table.assign(size, 0);
+    for (std::size_t i = 0; i < types.size(); ++i) {
+      auto &slot = table[hash(types[i])];
+      if (slot != 0)
+        return false;
+      slot = static_cast<std::uint32_t>(i + 1);
+    }
+    return true;
+  }
+
+  // entry index + 1, 0 for empty slots
+  std::vector<std::uint32_t> table = std::vector<std::uint32_t>(2, 0);
+  std::uint64_t multiplier = 1;
+  unsigned shift = 63;
+  std::vector<const std::type_info *> types;
+  std::vector<handler_type> handlers;
+  std::unordered_map<std::type_index, std::size_t> index;
+  unique_function<void(value_type &)> fallback;
+};
+} // namespace detail
+
+// Routes anys to handlers registered for their stored types: one hash of the
+// type_info address and one comparison, no chain of any_casts.
+template <class... Traits>
+using dispatcher = detail::dispatcher_t<any_trait::destructible, Traits...>;
+} // namespace awt
@@ -0,0 +1,385 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace awt {
+namespace detail {
+// executors register it on their threads, so a thread waiting for a future
+// keeps running pending tasks instead of blocking
+struct wait_helper {
+  // runs one pending task, false if there was none
+  bool (*run_one)(void *) = nullptr;
+  void *context = nullptr;
+};
+
+inline wait_helper &current_wait_helper() {
+  static thread_local wait_helper helper;
+  return helper;
+}
+
+// stored in place of the value of future<void>
+struct void_value {};
+
+template <class T>
+using stored_future_value =
+    std::conditional_t<std::is_void<T>::value, void_value, T>;
+
+// single allocation shared by a promise and its future, it also holds the
+// continuation attached by future::then
+template <class T> class shared_state {
+  using value_type = stored_future_value<T>;
+
+  enum : unsigned {
+    ready_flag = 1,
+    continuation_flag = 2,
+    future_retrieved_flag = 4,
+    waiting_flag = 8,
+  };
+
+public:
+  // called once with the ready state, on the thread making it ready or, if
+  // it was ready already, on the thread attaching it
+  using continuation_type = unique_function<void(shared_state &)>;
+
+  shared_state() = default;
+  shared_state(const shared_state &) = delete;
+  shared_state &operator=(const shared_state &) = delete;
+  ~shared_state() {
+    if (has_value)
+      value_ptr()->~value_type();
+  }
+
+  void add_ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+  void release() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete this;
+  }
+
+  // false if it was retrieved already
+  bool retrieve_future() {
+    return !(flags.fetch_or(future_retrieved_flag, std::memory_order_relaxed) &
+             future_retrieved_flag);
+  }
+
+  template <class... Args> void set_value(Args &&... args) {
+    new (&storage) value_type(std::forward<Args>(args)...);
+    has_value = true;
+    make_ready();
+  }
+
+  void set_exception(std::exception_ptr exception) {
+    error = std::move(exception);
+    make_ready();
+  }
+
+  template <class F> void set_continuation(F &&f) {
+    continuation = std::forward<F>(f);
+    if (flags.fetch_or(continuation_flag, std::memory_order_acq_rel) &
+        ready_flag)
+      run_continuation();
+  }
+
+  bool is_ready() const {
+    return flags.load(std::memory_order_acquire) & ready_flag;
+  }
+
+  void wait() {
+    auto &helper = current_wait_helper();
+    while (!is_ready()) {
+      if (!helper.run_one) {
+        std::unique_lock<std::mutex> lock(mutex);
+        flags.fetch_or(waiting_flag, std::memory_order_acq_rel);
+        ready_changed.wait(lock, [this] { return is_ready(); });
+        return;
+      }
+      if (!helper.run_one(helper.context))
+        std::this_thread::yield();
+    }
+  }
+
+  // ready state only, rethrows stored exception
+  value_type &&take_value() {
+    if (error)
+      std::rethrow_exception(error);
+    return std::move(*value_ptr());
+  }
+
+  value_type get() {
+    wait();
+    return take_value();
+  }
+
+  const std::exception_ptr &exception() const { return error; }
+
+private:
+  void make_ready() {
+    auto previous = flags.fetch_or(ready_flag, std::memory_order_acq_rel);
+    if (previous & waiting_flag) {
+      {
+        // waiter either sees the flag or is already waiting
+        std::lock_guard<std::mutex> lock(mutex);
+      }
+      ready_changed.notify_all();
+    }
+    if (previous & continuation_flag)
+      run_continuation();
+  }
+
+  void run_continuation() {
+    continuation(*this);
+    continuation.reset();
+  }
+
+  value_type *value_ptr() { return reinterpret_cast<value_type *>(&storage); }
+
+  std::atomic<int> refs{1};
+  std::atomic<unsigned> flags{0};
+  bool has_value = false;
+  std::exception_ptr error;
+  std::aligned_storage_t<sizeof(value_type), alignof(value_type)> storage;
+  continuation_type continuation;
+  std::mutex mutex;
+  std::condition_variable ready_changed;
+};
+
+template <class T> class shared_state_ptr {
+public:
+  shared_state_ptr() = default;
+  explicit shared_state_ptr(shared_state<T> *state) : state(state) {}
+  shared_state_ptr(const shared_state_ptr &other) : state(other.state) {
+    if (state)
+      state->add_ref();
+  }
+  shared_state_ptr(shared_state_ptr &&other) noexcept : state(other.state) {
+    other.state = nullptr;
+  }
+  shared_state_ptr &operator=(shared_state_ptr other) noexcept {
+    std::swap(state, other.state);
+    return *this;
+  }
+  ~shared_state_ptr() {
+    if (state)
+      state->release();
+  }
+
+  // new owner of a state referenced elsewhere
+  static shared_state_ptr share(shared_state<T> &state) {
+    state.add_ref();
+    return shared_state_ptr(&state);
+  }
+
+  shared_state<T> &operator*() const { return *state; }
+  shared_state<T> *operator->() const { return state; }
+  explicit operator bool() const { return state != nullptr; }
+
+private:
+  shared_state<T> *state = nullptr;
+};
+} // namespace detail
+
+template <class T> class promise;
+
+namespace detail {
+// std::result_of is gone in C++20 and std::invoke_result is not in C++14
+template <class F, class... Args>
+using call_result_t = decltype(std::declval<F>()(std::declval<Args>()...));
+
+template <class T, class F> struct continuation_result {
+  using type = call_result_t<F &, T &&>;
+};
+template <class F> struct continuation_result<void, F> {
+  using type = call_result_t<F &>;
+};
+
+template <class T, class F>
+using continuation_result_t = typename continuation_result<T, F>::type;
+
+template <class T, class R, class F> struct continuation;
+template <class T, class R, class F, class Executor>
+struct posted_continuation;
+} // namespace detail
+
+// Result of an asynchronous operation. Besides its shared state nothing is
+// allocated: a continuation attached with then() is stored inside the state.
+// Waiting on a thread of an executor helps running its tasks.
+template <class T> class future {
+public:
+  future() = default;
+
+  bool valid() const { return static_cast<bool>(state); }
+  bool is_ready() const { return state->is_ready(); }
+  void wait() const { state->wait(); }
+
+  // may be called once, rethrows exception stored by the promise
+  T get() {
+    auto state = std::move(this->state);
+    return get_impl(state, std::is_void<T>());
+  }
+
+  // f receives the value (nothing for future<void>) and runs on the thread
+  // which makes this future ready, exceptions skip f and are passed on
+  template <class F> future<detail::continuation_result_t<T, F>> then(F &&f) {
+    using result_type = detail::continuation_result_t<T, F>;
+    promise<result_type> p;
+    auto result = p.get_future();
+    auto state = std::move(this->state);
+    state->set_continuation(
+        detail::continuation<T, result_type, std::decay_t<F>>{
+            std::move(p), std::forward<F>(f)});
+    return result;
+  }
+
+  // the same, but f is posted to the executor
+  template <class Executor, class F>
+  future<detail::continuation_result_t<T, F>> then(Executor &executor,
+                                                   F &&f) {
+    using result_type = detail::continuation_result_t<T, F>;
+    promise<result_type> p;
+    auto result = p.get_future();
+    auto state = std::move(this->state);
+    state->set_continuation(
+        detail::posted_continuation<T, result_type, std::decay_t<F>, Executor>{
+            std::move(p), std::forward<F>(f), &executor});
+    return result;
+  }
+
+private:
+  explicit future(detail::shared_state_ptr<T> state)
+      : state(std::move(state)) {}
+
+  static T get_impl(detail::shared_state_ptr<T> &state, std::false_type) {
+    return state->get();
+  }
+  static void get_impl(detail::shared_state_ptr<T> &state, std::true_type) {
+    state->get();
+  }
+
+  detail::shared_state_ptr<T> state;
+
+  friend class promise<T>;
+};
+
+template <class T> class promise {
+public:
+  promise() : state(new detail::shared_state<T>()) {}
+  promise(promise &&) noexcept = default;
+  promise &operator=(promise &&other) noexcept {
+    promise(std::move(other)).swap(*this);
+    return *this;
+  }
+  // abandoned promise makes its future throw std::future_error
+  ~promise() {
+    if (state && !state->is_ready())
+      state->set_exception(std::make_exception_ptr(
+          std::future_error(std::future_errc::broken_promise)));
+  }
+
+  void swap(promise &other) noexcept { std::swap(state, other.state); }
+
+  future<T> get_future() {
+    if (!state->retrieve_future())
+      throw std::future_error(std::future_errc::future_already_retrieved);
+    return future<T>(state);
+  }
+
+  template <class... Args> void set_value(Args &&... args) {
+    if (state->is_ready())
+      throw std::future_error(std::future_errc::promise_already_satisfied);
+    state->set_value(std::forward<Args>(args)...);
+  }
+
+  void set_exception(std::exception_ptr exception) {
+    if (state->is_ready())
+      throw std::future_error(std::future_errc::promise_already_satisfied);
+    state->set_exception(std::move(exception));
+  }
+
+private:
+  detail::shared_state_ptr<T> state;
+};
+
+namespace detail {
+// stores result of f() or exception thrown by it into the promise
+template <class T, class F> void fulfil(promise<T> &p, F &f, std::false_type) {
+  try {
+    p.set_value(f());
+  } catch (...) {
+    p.set_exception(std::current_exception());
+  }
+}
+
+template <class T, class F> void fulfil(promise<T> &p, F &f, std::true_type) {
+  try {
+    f();
+    p.set_value();
+  } catch (...) {
+    p.set_exception(std::current_exception());
+  }
+}
+
+template <class T, class F> void fulfil(promise<T> &p, F &f) {
+  fulfil(p, f, std::is_void<T>());
+}
+
+// callables stored in anys are invoked as const
+template <class T, class F> struct promise_task {
+  void operator()() const { fulfil(p, f); }
+
+  mutable promise<T> p;
+  mutable F f;
+};
+
+template <class F> decltype(auto) call_with_value(F &f, void_value &&) {
+  return f();
+}
+template <class F, class T> decltype(auto) call_with_value(F &f, T &&value) {
+  return f(std::move(value));
+}
+
+// passes value of a ready state to f and its result to the promise
+template <class T, class R, class F>
+void continue_with(shared_state<T> &state, promise<R> &p, F &f) {
+  if (state.exception())
+    return p.set_exception(state.exception());
+  auto call = [&]() -> R { return call_with_value(f, state.take_value()); };
+  fulfil(p, call);
+}
+
+template <class T, class R, class F> struct continuation {
+  void operator()(shared_state<T> &state) const { continue_with(state, p, f); }
+
+  mutable promise<R> p;
+  mutable F f;
+};
+
+template <class T, class R, class F, class Executor>
+struct posted_continuation {
+  struct task {
+    void operator()() const { continue_with(*state, p, f); }
+
+    shared_state_ptr<T> state;
+    mutable promise<R> p;
+    mutable F f;
+  };
+
+  void operator()(shared_state<T> &ready) const {
+    executor->post(
+        task{shared_state_ptr<T>::share(ready), std::move(p), std::move(f)});
+  }
+
+  mutable promise<R> p;
+  mutable F f;
+  Executor *executor;
+};
+} // namespace detail
+} // namespace awt
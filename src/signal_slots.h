@@ -0,0 +1,236 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace awt {
+template <typename Signature> class signal;
+
+namespace detail {
+// bookkeeping shared by a signal and its connections, entries are parallel to
+// the signal's slots followed by slots connected during emission
+struct signal_core {
+  std::vector<std::uint64_t> ids;
+  std::vector<char> alive;
+  std::uint64_t next_id = 0;
+  bool has_dead = false;
+
+  std::size_t find(std::uint64_t id) const {
+    return std::find(ids.begin(), ids.end(), id) - ids.begin();
+  }
+
+  bool connected(std::uint64_t id) const {
+    auto i = find(id);
+    return i < ids.size() && alive[i];
+  }
+
+  // slot is only marked, it's destroyed by the signal later
+  void disconnect(std::uint64_t id) {
+    auto i = find(id);
+    if (i < ids.size() && alive[i]) {
+      alive[i] = false;
+      has_dead = true;
+    }
+  }
+};
+} // namespace detail
+
+// Handle to a slot of a signal, outliving the signal is fine
+class connection {
+public:
+  connection() = default;
+
+  bool connected() const {
+    auto locked = core.lock();
+    return locked && locked->connected(id);
+  }
+
+  // the slot is not called anymore, even by an emission in progress
+  void disconnect() {
+    if (auto locked = core.lock())
+      locked->disconnect(id);
+  }
+
+private:
+  connection(std::weak_ptr<detail::signal_core> core, std::uint64_t id)
+      : core(std::move(core)), id(id) {}
+
+  std::weak_ptr<detail::signal_core> core;
+  std::uint64_t id = 0;
+
+  template <typename Signature> friend class signal;
+};
+
+// Slots are kept in a single array with slots of the same type adjacent, so
+// emission looks up the call function once per type and then goes through
+// the array. Slots of one type are called in the order of connection.
+// Connecting and disconnecting from a slot is allowed: disconnected slots
+// are skipped right away and destroyed later, slots connected during
+// emission are called starting from the next one. Not thread safe.
+template <typename... Args> class signal<void(Args...)> {
+  using trait = any_trait::callable<void(Args...)>;
+  static_assert(detail::trait_impl<trait>::batch_invocable::value,
+                "arguments are passed to every slot and have to be copiable");
+
+public:
+  using slot_type = unique_function<void(Args...)>;
+
+  signal() : core(std::make_shared<detail::signal_core>()) {}
+  signal(signal &&) = default;
+  signal &operator=(signal &&) = default;
+
+  template <class F> connection connect(F &&f) {
+    auto id = core->next_id++;
+    if (emitting > 0) {
+      pending.emplace_back(std::forward<F>(f));
+      core->ids.push_back(id);
+      core->alive.push_back(true);
+    } else {
+      if (needs_maintenance())
+        maintain();
+      insert(slot_type(std::forward<F>(f)), id);
+      update_runs();
+    }
+    return {core, id};
+  }
+
+  void disconnect_all() {
+    std::fill(core->alive.begin(), core->alive.end(), false);
+    core->has_dead = true;
+    if (emitting == 0)
+      maintain();
+  }
+
+  // number of connected slots
+  std::size_t size() const {
+    return std::count(core->alive.begin(), core->alive.end(), true);
+  }
+  bool empty() const { return size() == 0; }
+
+  // exception thrown by a slot stops the emission and is passed on
+  void operator()(Args... args) {
+    if (emitting == 0 && needs_maintenance())
+      maintain();
+    ++emitting;
+    struct emission_guard {
+      int &emitting;
+      ~emission_guard() { --emitting; }
+    } guard{emitting};
+    for (auto &run : runs)
+      emit_run(run, args...);
+  }
+
+private:
+  using call_type =
+      typename detail::trait_impl<trait>::func_impl_base::signature;
+
+  // slots sharing a func table
+  struct slot_run {
+    std::size_t begin, end;
+    call_type call;
+    // values of the same type are either all inline or all on the heap
+    bool is_inline;
+  };
+
+  void emit_run(const slot_run &run, Args &... args) {
+    if (!run.call)
+      throw std::bad_function_call{};
+    for (auto i = run.begin; i < run.end; ++i) {
+      if (!core->alive[i])
+        continue;
+      auto storage = detail::any_access::storage(slots[i]);
+      run.call(run.is_inline ? storage : *static_cast<void **>(storage),
+               args...);
+    }
+  }
+
+  void update_runs() {
+    runs.clear();
+    std::size_t begin = 0, n = slots.size();
+    while (begin < n) {
+      auto &head = slots[begin];
+      auto f_table = detail::any_access::f_table(head);
+      auto end = begin + 1;
+      while (end < n && detail::any_access::f_table(slots[end]) == f_table)
+        ++end;
+      call_type call = nullptr;
+      if (head.has_value())
+        call = detail::any_access::visit_ftable(head, [](auto f_table) {
+          return detail::trait_f_table<trait>(f_table)->call_call;
+        });
+      runs.push_back({begin, end, call,
+                      detail::any_access::data_ptr(head) ==
+                          detail::any_access::storage(head)});
+      begin = end;
+    }
+  }
+
+  // keeps slots of the same type adjacent
+  void insert(slot_type &&slot, std::uint64_t id) {
+    auto f_table = detail::any_access::f_table(slot);
+    auto position = slots.size();
+    for (auto i = slots.size(); i > 0; --i)
+      if (detail::any_access::f_table(slots[i - 1]) == f_table) {
+        position = i;
+        break;
+      }
+    slots.insert(slots.begin() + position, std::move(slot));
+    core->ids.insert(core->ids.begin() + position, id);
+    core->alive.insert(core->alive.begin() + position, true);
+  }
+
+  // destroys disconnected slots and adds those connected during emission,
+  // never called while emitting
+  bool needs_maintenance() const {
+    return core->has_dead || !pending.empty();
+  }
+
+  void maintain() {
+    if (core->has_dead) {
+      auto slot_count = slots.size();
+      auto kept = remove_dead(slots, 0, 0);
+      auto kept_pending = remove_dead(pending, slot_count, kept);
+      core->ids.resize(kept + kept_pending);
+      core->alive.assign(core->ids.size(), true);
+      core->has_dead = false;
+    }
+    auto merged = slots.size();
+    std::vector<std::uint64_t> ids(core->ids.begin() + merged, core->ids.end());
+    core->ids.resize(merged);
+    core->alive.resize(merged);
+    for (std::size_t i = 0; i < pending.size(); ++i)
+      insert(std::move(pending[i]), ids[i]);
+    pending.clear();
+    update_runs();
+  }
+
+  // keeps alive values in order, their entries start at offset in the core
+  // and are moved to position
+  std::size_t remove_dead(std::vector<slot_type> &values, std::size_t offset,
+                          std::size_t position) {
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      if (!core->alive[offset + i])
+        continue;
+      if (kept != i)
+        values[kept] = std::move(values[i]);
+      core->ids[position + kept++] = core->ids[offset + i];
+    }
+    values.erase(values.begin() + kept, values.end());
+    return kept;
+  }
+
+  std::vector<slot_type> slots;
+  std::vector<slot_type> pending;
+  std::vector<slot_run> runs;
+  std::shared_ptr<detail::signal_core> core;
+  int emitting = 0;
+};
+} // namespace awt
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "any_with_traits.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+namespace awt {
+namespace detail {
+constexpr std::size_t cache_line_size = 64;
+
+inline std::size_t round_up_to_power_of_two(std::size_t value) {
+  std::size_t result = 2;
+  while (result < value)
+    result *= 2;
+  return result;
+}
+
+// value alone on its cache line, so neighbours are not invalidated together
+// with it
+template <class T> struct cache_line_padded {
+  T value;
+  char padding[cache_line_size - sizeof(T) % cache_line_size];
+};
+
+// default constructed values in a buffer starting at a cache line boundary
+template <class T> class cache_aligned_array {
+public:
+  explicit cache_aligned_array(std::size_t size)
+      : buffer(static_cast<char *>(
+            ::operator new(size * sizeof(T) + cache_line_size))),
+        count(size) {
+    auto address = reinterpret_cast<std::uintptr_t>(buffer.get());
+    auto aligned = (address + cache_line_size - 1) & ~(cache_line_size - 1);
+    values = reinterpret_cast<T *>(aligned);
+    for (std::size_t i = 0; i < size; ++i)
+      new (values + i) T();
+  }
+  cache_aligned_array(const cache_aligned_array &) = delete;
+  cache_aligned_array &operator=(const cache_aligned_array &) = delete;
+  ~cache_aligned_array() {
+    for (std::size_t i = 0; i < count; ++i)
+      values[i].~T();
+  }
+
+  std::size_t size() const { return count; }
+  T &operator[](std::size_t i) { return values[i]; }
+  const T &operator[](std::size_t i) const { return values[i]; }
+
+private:
+  struct deleter {
+    void operator()(char *buffer) const { ::operator delete(buffer); }
+  };
+
+  std::unique_ptr<char, deleter> buffer;
+  T *values = nullptr;
+  std::size_t count = 0;
+};
+} // namespace detail
+
+// Bounded lock-free multi producer multi consumer queue of tasks (Vyukov's
+// ring buffer). Tasks are stored inline in slots each occupying a whole cache
+// line and are only relocated on push and pop, for trivially copyable
+// callables this is a plain copy of the small buffer.
+class task_queue {
+public:
+  using task_type = unique_function<void()>;
+
+  // capacity is rounded up to a power of two
+  explicit task_queue(std::size_t capacity)
+      : slots(detail::round_up_to_power_of_two(capacity)),
+        mask(slots.size() - 1) {
+    enqueue_position.value.store(0, std::memory_order_relaxed);
+    dequeue_position.value.store(0, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < slots.size(); ++i)
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  task_queue(const task_queue &) = delete;
+  task_queue &operator=(const task_queue &) = delete;
+
+  std::size_t capacity() const { return mask + 1; }
+
+  // false if queue is full, task is left untouched then
+  bool try_push(task_type &&task) {
+    return try_emplace(std::move(task));
+  }
+
+  // callable is moved into the slot only if there is one
+  template <class F> bool try_emplace(F &&f) {
+    auto position = enqueue_position.value.load(std::memory_order_relaxed);
+    slot *target;
+    for (;;) {
+      target = &slots[position & mask];
+      auto sequence = target->sequence.load(std::memory_order_acquire);
+      auto difference = static_cast<std::intptr_t>(sequence) -
+                        static_cast<std::intptr_t>(position);
+      if (difference == 0) {
+        if (enqueue_position.value.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed))
+          break;
+      } else if (difference < 0)
+        return false;
+      else
+        position = enqueue_position.value.load(std::memory_order_relaxed);
+    }
+    target->task = std::forward<F>(f);
+    target->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // false if queue is empty
+  bool try_pop(task_type &task) {
+    auto position = dequeue_position.value.load(std::memory_order_relaxed);
+    slot *source;
+    for (;;) {
+      source = &slots[position & mask];
+      auto sequence = source->sequence.load(std::memory_order_acquire);
+      auto difference = static_cast<std::intptr_t>(sequence) -
+                        static_cast<std::intptr_t>(position + 1);
+      if (difference == 0) {
+        if (dequeue_position.value.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed))
+          break;
+      } else if (difference < 0)
+        return false;
+      else
+        position = dequeue_position.value.load(std::memory_order_relaxed);
+    }
+    task = std::move(source->task);
+    source->sequence.store(position + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // may be outdated by the time it is returned
+  bool empty() const {
+    return dequeue_position.value.load(std::memory_order_relaxed) >=
+           enqueue_position.value.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct slot {
+    std::atomic<std::size_t> sequence;
+    task_type task;
+    char padding[(detail::cache_line_size -
+                  (sizeof(std::atomic<std::size_t>) + sizeof(task_type)) %
+                      detail::cache_line_size) %
+                 detail::cache_line_size];
+  };
+
+  detail::cache_line_padded<std::atomic<std::size_t>> enqueue_position{};
+  detail::cache_line_padded<std::atomic<std::size_t>> dequeue_position{};
+  detail::cache_aligned_array<slot> slots;
+  std::size_t mask;
+};
+} // namespace awt
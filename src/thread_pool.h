@@ -0,0 +1,278 @@
+#pragma once
+
+#include "any_with_traits.h"
+#include "future.h"
+#include "task_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace awt {
+namespace detail {
+// Bounded Chase-Lev deque: the owner pushes and pops at the bottom, other
+// threads steal from the top. Tasks are stored inline, so a slot stays
+// occupied until whoever claimed it has moved the task out, and the owner
+// treats an occupied slot as a full deque.
+class work_stealing_deque {
+public:
+  using task_type = unique_function<void()>;
+
+  explicit work_stealing_deque(std::size_t capacity)
+      : slots(round_up_to_power_of_two(capacity)),
+        mask(static_cast<std::int64_t>(slots.size() - 1)) {
+    top.value.store(0, std::memory_order_relaxed);
+    bottom.value.store(0, std::memory_order_relaxed);
+  }
+
+  // owner only, callable is moved only on success
+  template <class F> bool try_push(F &&f) {
+    auto b = bottom.value.load(std::memory_order_relaxed);
+    auto t = top.value.load(std::memory_order_acquire);
+    if (b - t > mask)
+      return false;
+    auto &target = slots[b & mask].value;
+    if (target.occupied.load(std::memory_order_acquire))
+      return false;
+    target.task = std::forward<F>(f);
+    target.occupied.store(true, std::memory_order_relaxed);
+    bottom.value.store(b + 1, std::memory_order_release);
+    return true;
+  }
+
+  // owner only, takes the most recently pushed task
+  bool try_pop(task_type &task) {
+    auto b = bottom.value.load(std::memory_order_relaxed) - 1;
+    bottom.value.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top.value.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom.value.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    if (t == b) {
+      // the last task, thieves may be after it too
+      auto won = top.value.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom.value.store(b + 1, std::memory_order_relaxed);
+      if (!won)
+        return false;
+    }
+    take(slots[b & mask].value, task);
+    return true;
+  }
+
+  // any thread, takes the oldest task
+  bool try_steal(task_type &task) {
+    auto t = top.value.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto b = bottom.value.load(std::memory_order_acquire);
+    if (t >= b)
+      return false;
+    if (!top.value.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed))
+      return false;
+    take(slots[t & mask].value, task);
+    return true;
+  }
+
+private:
+  struct slot {
+    std::atomic<bool> occupied{false};
+    task_type task;
+  };
+
+  static void take(slot &source, task_type &task) {
+    task = std::move(source.task);
+    source.occupied.store(false, std::memory_order_release);
+  }
+
+  cache_line_padded<std::atomic<std::int64_t>> top{};
+  cache_line_padded<std::atomic<std::int64_t>> bottom{};
+  cache_aligned_array<cache_line_padded<slot>> slots;
+  std::int64_t mask;
+};
+} // namespace detail
+
+// Work stealing pool. Each worker has its own deque, tasks posted from a
+// worker go to its deque and are taken back in LIFO order, idle workers steal
+// the oldest tasks of others. Tasks posted from other threads go through a
+// shared injection queue. Waiting for a future or parallel_for on a worker
+// thread runs pending tasks meanwhile.
+class thread_pool {
+public:
+  using task_type = unique_function<void()>;
+
+  explicit thread_pool(
+      std::size_t threads = std::max(1u, std::thread::hardware_concurrency()),
+      std::size_t queue_capacity = 1024)
+      : injected(queue_capacity) {
+    for (std::size_t i = 0; i < threads; ++i)
+      workers.emplace_back(new worker(queue_capacity));
+    for (std::size_t i = 0; i < threads; ++i)
+      workers[i]->thread = std::thread([this, i] { work(i); });
+  }
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+  // runs all pending tasks before returning
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping.store(true);
+    }
+    wake.notify_all();
+    for (auto &w : workers)
+      w->thread.join();
+  }
+
+  std::size_t size() const { return workers.size(); }
+
+  // exception escaping the task terminates the program
+  template <class F> void post(F &&f) {
+    pending.fetch_add(1);
+    auto self = current_worker();
+    if (!self || self->pool != this ||
+        !workers[self->index]->tasks.try_push(std::forward<F>(f))) {
+      while (!injected.try_emplace(std::forward<F>(f)))
+        if (!run_one())
+          std::this_thread::yield();
+    }
+    if (sleeping.load() > 0) {
+      std::lock_guard<std::mutex> lock(mutex);
+      wake.notify_one();
+    }
+  }
+
+  // result or exception of f is delivered through the returned future
+  template <class F>
+  future<detail::call_result_t<std::decay_t<F> &>> submit(F &&f) {
+    using result_type = detail::call_result_t<std::decay_t<F> &>;
+    promise<result_type> p;
+    auto result = p.get_future();
+    post(detail::promise_task<result_type, std::decay_t<F>>{
+        std::move(p), std::forward<F>(f)});
+    return result;
+  }
+
+  // calls f(i) for every i in [first, last), calling thread takes part, the
+  // first exception thrown by f is rethrown
+  template <class F>
+  void parallel_for(std::size_t first, std::size_t last, const F &f) {
+    if (first >= last)
+      return;
+    struct loop_state {
+      std::size_t last, grain;
+      const F *f;
+      std::atomic<std::size_t> next;
+      std::atomic<std::size_t> helpers;
+      std::atomic_flag has_error = ATOMIC_FLAG_INIT;
+      std::exception_ptr error;
+
+      void run() {
+        try {
+          for (std::size_t i; (i = next.fetch_add(grain)) < last;)
+            for (auto end = std::min(i + grain, last); i < end; ++i)
+              (*f)(i);
+        } catch (...) {
+          if (!has_error.test_and_set())
+            error = std::current_exception();
+          next.store(last);
+        }
+      }
+    } state;
+    auto count = last - first;
+    state.last = last;
+    state.grain = std::max<std::size_t>(1, count / (size() * 8));
+    state.f = &f;
+    state.next.store(first);
+    auto helpers = std::min(size(), (count - 1) / state.grain);
+    state.helpers.store(helpers);
+    for (std::size_t i = 0; i < helpers; ++i)
+      post([&state] {
+        state.run();
+        state.helpers.fetch_sub(1, std::memory_order_release);
+      });
+    state.run();
+    while (state.helpers.load(std::memory_order_acquire) > 0)
+      if (!run_one())
+        std::this_thread::yield();
+    if (state.error)
+      std::rethrow_exception(state.error);
+  }
+
+private:
+  struct worker {
+    explicit worker(std::size_t capacity) : tasks(capacity) {}
+
+    detail::work_stealing_deque tasks;
+    std::thread thread;
+  };
+
+  struct worker_context {
+    thread_pool *pool;
+    std::size_t index;
+  };
+
+  static worker_context *&current_worker() {
+    static thread_local worker_context *context = nullptr;
+    return context;
+  }
+
+  // runs a single pending task on the calling thread
+  bool run_one() {
+    auto self = current_worker();
+    auto index = self && self->pool == this ? self->index : workers.size();
+    task_type task;
+    if (!(index < workers.size() && workers[index]->tasks.try_pop(task)) &&
+        !injected.try_pop(task) && !steal(index, task))
+      return false;
+    pending.fetch_sub(1);
+    task();
+    return true;
+  }
+
+  bool steal(std::size_t thief, task_type &task) {
+    auto n = workers.size();
+    for (std::size_t i = 1; i <= n; ++i) {
+      auto victim = (thief + i) % n;
+      if (victim != thief && workers[victim]->tasks.try_steal(task))
+        return true;
+    }
+    return false;
+  }
+
+  void work(std::size_t index) {
+    worker_context context{this, index};
+    current_worker() = &context;
+    detail::current_wait_helper() = {
+        [](void *pool) { return static_cast<thread_pool *>(pool)->run_one(); },
+        this};
+    for (;;) {
+      if (run_one())
+        continue;
+      std::unique_lock<std::mutex> lock(mutex);
+      sleeping.fetch_add(1);
+      wake.wait(lock, [this] { return pending.load() > 0 || stopping.load(); });
+      sleeping.fetch_sub(1);
+      if (stopping.load() && pending.load() == 0)
+        break;
+    }
+    detail::current_wait_helper() = {};
+    current_worker() = nullptr;
+  }
+
+  task_queue injected;
+  std::vector<std::unique_ptr<worker>> workers;
+  std::atomic<std::size_t> pending{0};
+  std::atomic<std::size_t> sleeping{0};
+  std::atomic<bool> stopping{false};
+  std::mutex mutex;
+  std::condition_variable wake;
+};
+} // namespace awt
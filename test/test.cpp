@@ -1,13 +1,35 @@
 #include "gtest.h"
 #include "any_with_traits.h"
+#include "any_collection.h"
+#include "any_algorithm.h"
+#include "any_flat_hash.h"
+#include "any_flat_map.h"
+#include "task_queue.h"
+#include "thread_pool.h"
+#include "atomic_any.h"
+#include "signal_slots.h"
+#include "dispatcher.h"
+#include "any_of.h"
+#include "any_visit.h"
+#include "any_serialization.h"
+#include "any_archive.h"
+#include "any_format.h"
+#include "any_parse.h"
+#include "any_storage_info.h"
+#ifdef AWT_ENABLE_COROUTINES
+#include "coroutine.h"
+#endif
 
 #include <array>
+#include <cstdio>
+#include <limits>
 #include <map>
 #include <memory>
 #include <functional>
 #include <unordered_set>
 #include <algorithm>
 #include <sstream>
+#include <thread>
 
 TEST(any, all) {
   {
@@ -216,3 +238,1550 @@ TEST(any, custom_traits) {
     EXPECT_EQ(777, v.call_secret_free_function_on_me());
   }
 }
+
+TEST(any, heap_only) {
+  {
+    EXPECT_EQ(2 * sizeof(void *), sizeof(awt::normal_heap_any));
+    awt::normal_heap_any v(17);
+    EXPECT_TRUE(v.type() == typeid(int));
+    EXPECT_EQ(17, awt::any_cast<int>(v));
+    auto v2 = v;
+    EXPECT_EQ(17, awt::any_cast<int>(v2));
+    auto v3 = std::move(v);
+    EXPECT_FALSE(v.has_value());
+    EXPECT_EQ(17, awt::any_cast<int>(v3));
+    v3 = std::vector<int>(1000, 5);
+    EXPECT_EQ(1000u, awt::any_cast<std::vector<int>>(v3).size());
+    v3.reset();
+    EXPECT_FALSE(v3.has_value());
+  }
+  {
+    using any = awt::heap_any<any_trait::orderable, any_trait::movable,
+                              any_trait::hashable, any_trait::comparable>;
+    std::vector<any> v;
+    v.emplace_back(25);
+    v.emplace_back(std::string("abc"));
+    v.emplace_back(-15);
+    v.emplace_back();
+    std::sort(v.begin(), v.end());
+    EXPECT_FALSE(v.front().has_value());
+    EXPECT_TRUE(std::is_sorted(v.begin(), v.end()));
+    auto it = std::find(v.begin(), v.end(), any(-15));
+    ASSERT_NE(v.end(), it);
+    EXPECT_EQ(any(25), *std::next(it));
+    EXPECT_EQ(any(-15).hash(), it->hash());
+    std::unordered_set<any> s;
+    s.insert(std::string("abc"));
+    EXPECT_EQ(1u, s.count(std::string("abc")));
+  }
+}
+
+namespace {
+struct counted_empty {
+  static int alive;
+  counted_empty() { ++alive; }
+  counted_empty(const counted_empty &) { ++alive; }
+  ~counted_empty() { --alive; }
+  int operator()(int a, int b) const { return a * b; }
+};
+int counted_empty::alive = 0;
+}
+
+TEST(any, stateless) {
+  auto lambda = [](int a, int b) { return a - b; };
+  static_assert(awt::detail::is_stateless<std::plus<int>>::value, "");
+  static_assert(awt::detail::is_stateless<decltype(lambda)>::value, "");
+  static_assert(!awt::detail::is_stateless<counted_empty>::value, "");
+  {
+    awt::function<int(int, int)> f = std::plus<int>{};
+    EXPECT_EQ(17, f(12, 5));
+    auto g = f;
+    EXPECT_EQ(9, g(4, 5));
+    f = lambda;
+    EXPECT_EQ(7, f(12, 5));
+    EXPECT_NE(nullptr, awt::any_cast<decltype(lambda)>(&f));
+    g = std::move(f);
+    EXPECT_FALSE(f.has_value());
+    EXPECT_EQ(-1, g(4, 5));
+    swap(f, g);
+    EXPECT_EQ(-1, f(4, 5));
+  }
+  {
+    awt::function<int(int, int)> f = counted_empty{};
+    EXPECT_EQ(1, counted_empty::alive);
+    auto g = f;
+    EXPECT_EQ(2, counted_empty::alive);
+    EXPECT_EQ(20, g(4, 5));
+    f.reset();
+    g = std::plus<int>{};
+    EXPECT_EQ(0, counted_empty::alive);
+  }
+  {
+    awt::heap_any<any_trait::copiable, any_trait::movable,
+                  any_trait::callable<int(int, int)>>
+        f = std::plus<int>{};
+    auto g = f;
+    EXPECT_EQ(17, g(12, 5));
+  }
+}
+
+namespace {
+struct particle {
+  int position = 0;
+  void update() { position += 1; }
+};
+
+struct projectile {
+  int position = 0;
+  int speed = 10;
+  void update() { position += speed; }
+};
+} // namespace
+
+AWT_DEFINE_MEMBER_FUNCTION_CALL_TRAIT(has_update, update, void());
+
+TEST(any_collection, all) {
+  awt::any_collection<any_trait::has_update> c;
+  EXPECT_TRUE(c.empty());
+  for (int i = 0; i < 3; ++i) {
+    c.insert(particle{});
+    c.emplace<projectile>();
+  }
+  c.insert(particle{});
+  EXPECT_EQ(7u, c.size());
+  EXPECT_EQ(4u, c.size<particle>());
+  EXPECT_EQ(3u, c.size<projectile>());
+  EXPECT_EQ(0u, c.size<int>());
+
+  int visited = 0;
+  c.for_each([&](awt::any_ref<any_trait::has_update> &v) {
+    v.update();
+    ++visited;
+  });
+  EXPECT_EQ(7, visited);
+  for (auto it = c.begin<projectile>(); it != c.end<projectile>(); ++it)
+    EXPECT_EQ(10, it->position);
+
+  c.for_each<particle>([](particle &p) { p.update(); });
+  for (auto it = c.begin<particle>(); it != c.end<particle>(); ++it)
+    EXPECT_EQ(2, it->position);
+
+  c.for_each([](awt::any_ref<any_trait::has_update> &v) {
+    if (auto p = awt::any_cast<projectile>(&v))
+      p->speed = 1;
+  });
+  c.for_each<particle, projectile>([](auto &v) { v.update(); });
+  EXPECT_EQ(11, c.begin<projectile>()->position);
+  EXPECT_EQ(3, c.begin<particle>()->position);
+
+  c.clear();
+  EXPECT_EQ(0u, c.size());
+  EXPECT_EQ(c.begin<particle>(), c.end<particle>());
+}
+
+namespace {
+struct counted_payload {
+  static int copies;
+  static int alive;
+  counted_payload() { ++alive; }
+  counted_payload(const counted_payload &other) : values(other.values) {
+    ++copies;
+    ++alive;
+  }
+  ~counted_payload() { --alive; }
+  void update() { ++values[0]; }
+  std::array<int, 16> values{};
+};
+int counted_payload::copies = 0;
+int counted_payload::alive = 0;
+} // namespace
+
+TEST(any, shared_storage) {
+  EXPECT_EQ(sizeof(awt::normal_any), sizeof(awt::normal_shared_any));
+  {
+    awt::normal_shared_any v = counted_payload{};
+    counted_payload::copies = 0;
+    std::vector<awt::normal_shared_any> copies(10, v);
+    EXPECT_EQ(0, counted_payload::copies);
+    EXPECT_EQ(1, counted_payload::alive);
+    const auto &first = copies.front();
+    const auto &original = v;
+    EXPECT_EQ(awt::any_cast<counted_payload>(&first),
+              awt::any_cast<counted_payload>(&original));
+
+    // copy on write
+    awt::any_cast<counted_payload>(copies.back()).values[0] = 5;
+    EXPECT_EQ(1, counted_payload::copies);
+    EXPECT_EQ(2, counted_payload::alive);
+    EXPECT_EQ(0, awt::any_cast<counted_payload>(first).values[0]);
+    EXPECT_EQ(5, awt::any_cast<counted_payload>(copies.back()).values[0]);
+    awt::any_cast<counted_payload>(copies.back()).values[0] = 6;
+    EXPECT_EQ(1, counted_payload::copies);
+    EXPECT_EQ(nullptr, awt::any_cast<int>(&copies.front()));
+    EXPECT_EQ(1, counted_payload::copies);
+
+    auto moved = std::move(copies.front());
+    EXPECT_FALSE(copies.front().has_value());
+    copies.clear();
+    v.reset();
+    EXPECT_EQ(1, counted_payload::alive);
+    awt::any_cast<counted_payload>(moved).values[0] = 1;
+    EXPECT_EQ(1, counted_payload::copies);
+
+    v = 17;
+    auto w = v;
+    awt::any_cast<int>(w) = 18;
+    EXPECT_EQ(17, awt::any_cast<int>(v));
+  }
+  EXPECT_EQ(0, counted_payload::alive);
+  {
+    using any = awt::shared_any<any_trait::copiable, any_trait::movable,
+                                any_trait::has_update>;
+    any v = counted_payload{};
+    auto w = v;
+    counted_payload::copies = 0;
+    w.update();
+    EXPECT_EQ(1, counted_payload::copies);
+    EXPECT_EQ(0, awt::any_cast<counted_payload>(v).values[0]);
+    EXPECT_EQ(1, awt::any_cast<counted_payload>(w).values[0]);
+  }
+  EXPECT_EQ(0, counted_payload::alive);
+  {
+    using any = awt::shared_any<any_trait::copiable, any_trait::movable,
+                                any_trait::orderable, any_trait::hashable,
+                                any_trait::comparable>;
+    std::vector<any> v{std::string(100, 'c'), std::string(100, 'a'),
+                       std::string(100, 'b')};
+    auto copy = v;
+    awt::sort(v.begin(), v.end());
+    EXPECT_TRUE(std::is_sorted(v.begin(), v.end()));
+    EXPECT_EQ(copy[1], v[0]);
+    EXPECT_EQ(copy[1].hash(), v[0].hash());
+  }
+}
+
+TEST(any, unique_ptr) {
+  using value = awt::any<any_trait::movable>;
+  {
+    using block = std::array<int, 100>;
+    auto ptr = std::make_unique<block>();
+    auto raw = ptr.get();
+    (*ptr)[0] = 5;
+    value v;
+    v.adopt(std::move(ptr));
+    EXPECT_EQ(raw, awt::any_cast<block>(&v));
+    EXPECT_EQ(nullptr, v.release<int>());
+    auto released = v.release<block>();
+    EXPECT_FALSE(v.has_value());
+    EXPECT_EQ(raw, released.get());
+    EXPECT_EQ(5, (*released)[0]);
+  }
+  {
+    // small values are moved in and out of the any
+    value v;
+    v.adopt(std::make_unique<int>(3));
+    EXPECT_EQ(3, awt::any_cast<int>(v));
+    EXPECT_EQ(3, *v.release<int>());
+    EXPECT_FALSE(v.has_value());
+    v.adopt(std::unique_ptr<int>());
+    EXPECT_FALSE(v.has_value());
+    EXPECT_EQ(nullptr, v.release<int>());
+  }
+  {
+    awt::heap_any<any_trait::movable> v;
+    auto ptr = std::make_unique<int>(7);
+    auto raw = ptr.get();
+    v.adopt(std::move(ptr));
+    EXPECT_EQ(raw, v.release<int>().get());
+  }
+  {
+    // shared values are copied out unless unique
+    awt::normal_shared_any v = std::vector<int>(10);
+    auto copy = v;
+    auto released = v.release<std::vector<int>>();
+    EXPECT_EQ(10u, released->size());
+    EXPECT_EQ(10u, awt::any_cast<std::vector<int>>(copy).size());
+    v.adopt(std::move(released));
+    EXPECT_EQ(10u, awt::any_cast<std::vector<int>>(v).size());
+  }
+}
+
+TEST(any, narrowing) {
+  using wide = awt::any<any_trait::copiable, any_trait::movable,
+                        any_trait::hashable, any_trait::comparable>;
+  using narrow = awt::any<any_trait::movable>;
+  {
+    // large value keeps its allocation
+    wide w = std::string(100, 'a');
+    auto data = awt::any_cast<std::string>(&w)->data();
+    narrow n = std::move(w);
+    EXPECT_FALSE(w.has_value());
+    EXPECT_EQ(typeid(std::string), n.type());
+    EXPECT_EQ(data, awt::any_cast<std::string>(&n)->data());
+    n = wide(5);
+    EXPECT_EQ(5, awt::any_cast<int>(n));
+    n = wide();
+    EXPECT_FALSE(n.has_value());
+  }
+  {
+    // small values are relocated, the source copy is kept
+    const wide w = std::string("abc");
+    awt::any<any_trait::copiable, any_trait::movable> n(w);
+    EXPECT_EQ(w, wide(awt::any_cast<std::string>(n)));
+    n = w;
+    EXPECT_EQ("abc", awt::any_cast<std::string>(n));
+    EXPECT_EQ("abc", awt::any_cast<std::string>(w));
+  }
+  {
+    // same traits in different order
+    using reordered = awt::any<any_trait::comparable, any_trait::hashable,
+                               any_trait::movable, any_trait::copiable>;
+    reordered r = wide(std::string("abc"));
+    EXPECT_EQ(reordered(std::string("abc")), r);
+    EXPECT_EQ(reordered(std::string("abc")).hash(), r.hash());
+    wide back = std::move(r);
+    EXPECT_EQ(wide(std::string("abc")), back);
+  }
+  {
+    // a table is made once per stored type, whichever thread converts first
+    using subset = awt::any<any_trait::movable, any_trait::comparable>;
+    std::vector<const void *> tables(8);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < tables.size(); ++i)
+      threads.emplace_back([&tables, i] {
+        subset s = wide(std::string("abc"));
+        tables[i] = awt::detail::any_access::f_table(s);
+      });
+    for (auto &t : threads)
+      t.join();
+    subset s = wide(std::string("abc"));
+    EXPECT_EQ(subset(std::string("abc")), s);
+    for (auto table : tables)
+      EXPECT_EQ(awt::detail::any_access::f_table(s), table);
+  }
+  {
+    awt::any<any_trait::movable, any_trait::has_example_function> w(c1{});
+    awt::any<any_trait::has_example_function> n(std::move(w));
+    EXPECT_EQ(5, n.example_function(2, 3));
+  }
+  {
+    awt::normal_shared_any w = std::vector<int>(10);
+    auto copy = w;
+    awt::any<any_trait::shared_storage, any_trait::movable> n = std::move(w);
+    awt::any_cast<std::vector<int>>(&n)->push_back(1);
+    EXPECT_EQ(11u, awt::any_cast<std::vector<int>>(n).size());
+    EXPECT_EQ(10u, awt::any_cast<std::vector<int>>(copy).size());
+  }
+  {
+    awt::heap_any<any_trait::movable, any_trait::comparable> w = 3;
+    awt::heap_any<any_trait::movable> n = std::move(w);
+    EXPECT_EQ(3, awt::any_cast<int>(n));
+  }
+  {
+    // anys with a different storage layout are stored as values
+    awt::any<any_trait::movable, any_trait::ostreamable> other = 1;
+    awt::heap_any<any_trait::movable> n = std::move(other);
+    EXPECT_EQ(typeid(other), n.type());
+  }
+}
+
+namespace {
+struct labeled_point {
+  int x, y;
+  std::string label;
+};
+} // namespace
+
+template <> struct awt::serializer<labeled_point> {
+  static void write(awt::writer &out, const labeled_point &value) {
+    out.write_value(value.x);
+    out.write_value(value.y);
+    awt::serializer<std::string>::write(out, value.label);
+  }
+  static labeled_point read(awt::reader &in) {
+    labeled_point result;
+    result.x = in.read_value<int>();
+    result.y = in.read_value<int>();
+    result.label = awt::serializer<std::string>::read(in);
+    return result;
+  }
+};
+
+namespace {
+// trivially copyable, but without default constructor
+struct serialized_id {
+  explicit serialized_id(int value) : value(value) {}
+  int value;
+};
+} // namespace
+
+TEST(any, serialization) {
+  using value = awt::any<any_trait::movable, any_trait::serializable>;
+  auto &registry = awt::serialization_registry<value>::instance();
+  registry.add<int>("int");
+  registry.add<double>("double");
+  registry.add<std::string>("string");
+  registry.add<std::vector<int>>("vector<int>");
+  registry.add<labeled_point>("labeled_point");
+  registry.add<serialized_id>("serialized_id");
+  registry.add<std::vector<serialized_id>>("vector<serialized_id>");
+  EXPECT_TRUE(registry.contains<int>());
+  EXPECT_FALSE(registry.contains<char>());
+  EXPECT_THROW(registry.add<char>("int"), awt::serialization_error);
+
+  std::vector<value> values;
+  values.emplace_back(5);
+  values.emplace_back(2.5);
+  values.emplace_back(std::string("abc"));
+  values.emplace_back();
+  values.emplace_back(std::vector<int>{1, 2, 3});
+  values.emplace_back(labeled_point{1, 2, "p"});
+  values.emplace_back(serialized_id(7));
+  values.emplace_back(std::vector<serialized_id>{serialized_id(8)});
+
+  // too small buffer reports the size needed
+  char small[4];
+  awt::writer counter(small, sizeof(small));
+  for (auto &v : values)
+    v.serialize(counter);
+  EXPECT_TRUE(counter.overflow());
+  std::vector<char> buffer(counter.size());
+  awt::writer out(buffer.data(), buffer.size());
+  for (auto &v : values)
+    v.serialize(out);
+  EXPECT_FALSE(out.overflow());
+  EXPECT_EQ(buffer.size(), out.size());
+
+  awt::reader in(buffer.data(), buffer.size());
+  EXPECT_EQ(5, awt::any_cast<int>(awt::deserialize<value>(in)));
+  EXPECT_EQ(2.5, awt::any_cast<double>(registry.read(in)));
+  EXPECT_EQ("abc", awt::any_cast<std::string>(registry.read(in)));
+  EXPECT_FALSE(registry.read(in).has_value());
+  EXPECT_EQ((std::vector<int>{1, 2, 3}),
+            awt::any_cast<std::vector<int>>(registry.read(in)));
+  auto point = awt::any_cast<labeled_point>(registry.read(in));
+  EXPECT_EQ(2, point.y);
+  EXPECT_EQ("p", point.label);
+  EXPECT_EQ(7, awt::any_cast<serialized_id>(registry.read(in)).value);
+  EXPECT_EQ(8, awt::any_cast<std::vector<serialized_id>>(registry.read(in))
+                   .front()
+                   .value);
+  EXPECT_EQ(0u, in.remaining());
+  EXPECT_THROW(registry.read(in), awt::serialization_error);
+
+  // unknown types fail on both ends
+  awt::writer unused(buffer.data(), buffer.size());
+  EXPECT_THROW(value(short(1)).serialize(unused), awt::serialization_error);
+  std::uint64_t unknown[2] = {1, 0};
+  awt::reader unknown_in(unknown, 12);
+  EXPECT_THROW(registry.read(unknown_in), awt::serialization_error);
+}
+
+TEST(any, archive) {
+  using value = awt::any<any_trait::movable, any_trait::serializable>;
+  auto &registry = awt::serialization_registry<value>::instance();
+  registry.add<int>("int");
+  registry.add<double>("double");
+  registry.add<std::string>("string");
+
+  awt::archive_builder builder;
+  for (int i = 0; i < 1000; ++i) {
+    builder.add(value(i));
+    builder.add(value(std::string(i % 50, 'x')));
+  }
+  builder.add(value());
+  builder.add(value(0.5));
+  EXPECT_EQ(2002u, builder.size());
+
+  const char *path = "awt_archive_test.bin";
+  builder.save(path);
+  {
+    awt::archive archive(path);
+    ASSERT_EQ(2002u, archive.size());
+    long sum = 0;
+    for (std::size_t i = 0; i < 2000; i += 2) {
+      auto number = archive[i];
+      ASSERT_TRUE(number.is<int>());
+      sum += *number.get<int>();
+      EXPECT_EQ(nullptr, number.get<double>());
+      EXPECT_EQ(i / 2 % 50, archive[i + 1].load<std::string>().size());
+    }
+    EXPECT_EQ(499500, sum);
+    EXPECT_FALSE(archive[2000].has_value());
+    EXPECT_EQ(0.5, *archive[2001].get<double>());
+    EXPECT_THROW(archive[2001].load<int>(), std::bad_cast);
+    auto materialized = archive[3].materialize<value>();
+    EXPECT_EQ(std::string(1, 'x'), awt::any_cast<std::string>(materialized));
+    EXPECT_FALSE(archive[2000].materialize<value>().has_value());
+  }
+  std::remove(path);
+  EXPECT_THROW(awt::archive("awt_archive_test_missing.bin"),
+               awt::serialization_error);
+
+  auto bytes = builder.data();
+  awt::archive in_memory(bytes.data(), bytes.size());
+  EXPECT_EQ(7, *in_memory[14].get<int>());
+  EXPECT_THROW(awt::archive(bytes.data(), 10), awt::serialization_error);
+  bytes[0] = 'x';
+  EXPECT_THROW(awt::archive(bytes.data(), bytes.size()),
+               awt::serialization_error);
+}
+
+namespace {
+struct version {
+  int major, minor;
+};
+
+struct streamed {
+  friend std::ostream &operator<<(std::ostream &os, const streamed &) {
+    return os << "streamed";
+  }
+};
+} // namespace
+
+template <> struct awt::formatter<version> {
+  static std::size_t format(const version &value, char *buffer,
+                            std::size_t capacity) {
+    return std::snprintf(buffer, capacity, "v%d.%d", value.major,
+                         value.minor);
+  }
+};
+
+TEST(any, formattable) {
+  using value = awt::any<any_trait::movable, any_trait::formattable>;
+  EXPECT_EQ("", awt::to_string(value()));
+  EXPECT_EQ("-42", awt::to_string(value(-42)));
+  EXPECT_EQ("-9223372036854775808",
+            awt::to_string(value(std::numeric_limits<std::int64_t>::min())));
+  EXPECT_EQ("18446744073709551615",
+            awt::to_string(value(std::numeric_limits<std::uint64_t>::max())));
+  EXPECT_EQ(0.1, std::stod(awt::to_string(value(0.1))));
+  EXPECT_EQ("true", awt::to_string(value(true)));
+  EXPECT_EQ("c", awt::to_string(value('c')));
+  EXPECT_EQ("text", awt::to_string(value(std::string("text"))));
+  EXPECT_EQ("literal", awt::to_string(value("literal")));
+  EXPECT_EQ("v1.2", awt::to_string(value(version{1, 2})));
+  EXPECT_EQ("streamed", awt::to_string(value(streamed())));
+  EXPECT_EQ(std::string(100, 'a'),
+            awt::to_string(value(std::string(100, 'a'))));
+
+  // text that doesn't fit is cut, its full size is returned
+  char buffer[4];
+  EXPECT_EQ(6u, value(123456).format_to(buffer, sizeof(buffer)));
+  EXPECT_EQ("1234", std::string(buffer, sizeof(buffer)));
+
+  std::stringstream ss;
+  ss << value(7) << ' ' << value(std::string(200, 'b'));
+  EXPECT_EQ("7 " + std::string(200, 'b'), ss.str());
+
+  // both traits together use ostreamable operator
+  awt::any<any_trait::formattable, any_trait::ostreamable> both(3);
+  std::stringstream both_ss;
+  both_ss << both;
+  EXPECT_EQ("3", both_ss.str());
+  EXPECT_EQ("3", awt::to_string(both));
+}
+
+TEST(any, parsable) {
+  using value = awt::any<any_trait::movable, any_trait::parsable>;
+  auto &registry = awt::parse_registry<value>::instance();
+  registry.add<int>("int");
+  registry.add<std::uint8_t>("u8");
+  registry.add<std::int64_t>("i64");
+  registry.add<double>("double");
+  registry.add<bool>("bool");
+  registry.add<std::string>("string");
+
+  value v;
+  EXPECT_TRUE(registry.parse("int", "-42", v));
+  EXPECT_EQ(-42, awt::any_cast<int>(v));
+  EXPECT_FALSE(registry.parse("int", "42x", v));
+  EXPECT_FALSE(v.has_value());
+  EXPECT_FALSE(registry.parse("int", "", v));
+  EXPECT_FALSE(registry.parse("int", "2147483648", v));
+  EXPECT_TRUE(registry.parse("int", "-2147483648", v));
+  EXPECT_TRUE(registry.parse("u8", "255", v));
+  EXPECT_EQ(255, awt::any_cast<std::uint8_t>(v));
+  EXPECT_FALSE(registry.parse("u8", "256", v));
+  EXPECT_FALSE(registry.parse("u8", "-1", v));
+  EXPECT_TRUE(registry.parse("i64", "-9223372036854775808", v));
+  EXPECT_EQ(std::numeric_limits<std::int64_t>::min(),
+            awt::any_cast<std::int64_t>(v));
+  EXPECT_TRUE(registry.parse("double", "2.5e3", v));
+  EXPECT_EQ(2500., awt::any_cast<double>(v));
+  EXPECT_FALSE(registry.parse("double", " 1", v));
+  EXPECT_FALSE(registry.parse("double", "1.5.", v));
+  EXPECT_TRUE(registry.parse("bool", "true", v));
+  EXPECT_TRUE(awt::any_cast<bool>(v));
+  EXPECT_TRUE(registry.parse("string", "some text", v));
+  EXPECT_EQ("some text", awt::any_cast<std::string>(v));
+  EXPECT_THROW(registry.parse("float", "1", v), std::invalid_argument);
+
+  // text is parsed as the type already stored
+  value number = 1.5;
+  EXPECT_TRUE(number.parse("0.25"));
+  EXPECT_EQ(0.25, awt::any_cast<double>(number));
+  EXPECT_FALSE(number.parse("abc"));
+  EXPECT_EQ(0.25, awt::any_cast<double>(number));
+  EXPECT_FALSE(value().parse("1"));
+}
+
+TEST(any, overaligned_values) {
+  struct alignas(16) vector4 {
+    float v[4];
+  };
+  // small buffer is only pointer aligned, such values go to the heap
+  awt::normal_any v(vector4{{1, 2, 3, 4}});
+  auto &stored = awt::any_cast<vector4>(v);
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(&stored) % 16);
+  EXPECT_EQ(4.f, stored.v[3]);
+  auto copy = v;
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(
+                    &awt::any_cast<vector4>(copy)) % 16);
+  awt::normal_any moved = std::move(copy);
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(
+                    &awt::any_cast<vector4>(moved)) % 16);
+  v.emplace<vector4>();
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(
+                    &awt::any_cast<vector4>(v)) % 16);
+}
+
+TEST(any, storage_info) {
+  struct alignas(16) vector4 {
+    float v[4];
+  };
+  using small = awt::storage_info<awt::normal_any, int>;
+  static_assert(small::kind == awt::storage_kind::small, "");
+  static_assert(small::is_inline && small::trivial_move, "");
+  EXPECT_EQ(awt::detail::any_small_size - sizeof(int), small::wasted_bytes);
+  EXPECT_EQ(0u, small::heap_bytes);
+
+  using large = awt::storage_info<awt::normal_any, std::array<char, 100>>;
+  static_assert(large::kind == awt::storage_kind::large, "");
+  static_assert(large::too_large && !large::overaligned, "");
+  EXPECT_EQ(100u, large::heap_bytes);
+
+  using text = awt::storage_info<awt::normal_any, std::string>;
+  EXPECT_EQ(sizeof(std::string) <= awt::detail::any_small_size,
+            text::is_inline);
+  EXPECT_TRUE(text::nothrow_move);
+  EXPECT_EQ(!text::is_inline, text::trivial_move);
+
+  // small but more strictly aligned than the small buffer
+  using aligned = awt::storage_info<awt::normal_any, vector4>;
+  static_assert(!aligned::too_large && aligned::overaligned, "");
+  static_assert(aligned::kind == awt::storage_kind::large, "");
+
+  using shared = awt::storage_info<awt::normal_shared_any, vector4>;
+  static_assert(shared::kind == awt::storage_kind::shared, "");
+  EXPECT_EQ(awt::detail::shared_block::header_size + sizeof(vector4),
+            shared::heap_bytes);
+
+  using heap = awt::storage_info<awt::normal_heap_any, int>;
+  static_assert(heap::kind == awt::storage_kind::large, "");
+  EXPECT_EQ(0u, heap::wasted_bytes);
+
+#ifdef AWT_ENABLE_INSTRUMENTATION
+  awt::normal_any l(std::array<char, 100>{});
+  auto types = awt::heap_types();
+  const std::string name = "std::array<char, 100ul>";
+  auto it = std::find_if(types.begin(), types.end(),
+                         [&](const auto &t) { return t.name == name; });
+  ASSERT_NE(types.end(), it);
+  EXPECT_LE(1u, it->constructions);
+  std::stringstream ss;
+  awt::print_heap_types(ss);
+  EXPECT_NE(std::string::npos, ss.str().find(name));
+#else
+  EXPECT_TRUE(awt::heap_types().empty());
+#endif
+}
+
+TEST(any_algorithm, batch) {
+  using any = awt::any<any_trait::movable, any_trait::copiable,
+                       any_trait::hashable, any_trait::comparable>;
+  std::vector<any> v;
+  for (int i = 0; i < 10; ++i)
+    v.emplace_back(i);
+  v.emplace_back();
+  v.emplace_back();
+  v.emplace_back(std::string("abc"));
+  v.emplace_back(std::string("def"));
+  for (int i = 0; i < 5; ++i)
+    v.emplace_back(i * 0.5);
+  {
+    std::vector<std::size_t> hashes(v.size());
+    awt::batch_hash(v.data(), v.data() + v.size(), hashes.data());
+    for (std::size_t i = 0; i < v.size(); ++i)
+      EXPECT_EQ(v[i].hash(), hashes[i]);
+  }
+  {
+    auto w = v;
+    w[3] = 4;
+    w[10] = 3;
+    w[12] = std::string("abc");
+    w[14] = 7;
+    std::unique_ptr<bool[]> equal(new bool[v.size()]);
+    awt::batch_equal(v.data(), v.data() + v.size(), w.data(), equal.get());
+    for (std::size_t i = 0; i < v.size(); ++i)
+      EXPECT_EQ(v[i] == w[i], equal[i]);
+    EXPECT_FALSE(equal[3]);
+    EXPECT_FALSE(equal[10]);
+    EXPECT_TRUE(equal[11]);
+    EXPECT_TRUE(equal[12]);
+    EXPECT_FALSE(equal[14]);
+  }
+  {
+    int sum = 0;
+    std::vector<awt::function<int(int)>> f;
+    for (int i = 0; i < 3; ++i)
+      f.emplace_back([&sum](int x) { return sum += x; });
+    f.emplace_back([&sum](int x) { return sum -= x; });
+    awt::batch_invoke(f.data(), f.data() + f.size(), 5);
+    EXPECT_EQ(10, sum);
+    f.emplace_back();
+    EXPECT_THROW(awt::batch_invoke(f.data(), f.data() + f.size(), 5),
+                 std::bad_function_call);
+  }
+}
+
+TEST(any_algorithm, sort) {
+  using any =
+      awt::any<any_trait::orderable, any_trait::movable, any_trait::copiable>;
+  auto make_values = [](int count) {
+    std::vector<any> v;
+    unsigned seed = 17;
+    for (int i = 0; i < count; ++i) {
+      seed = seed * 1103515245u + 12345u;
+      auto x = static_cast<int>(seed >> 16) % 1000;
+      switch (i % 5) {
+      case 0:
+        v.emplace_back(x);
+        break;
+      case 1:
+        v.emplace_back(std::to_string(x));
+        break;
+      case 2:
+        v.emplace_back(x * 0.25);
+        break;
+      case 3:
+        v.emplace_back(std::vector<int>(x % 7, x));
+        break;
+      case 4:
+        if (x % 3 == 0)
+          v.emplace_back();
+        else
+          v.emplace_back(static_cast<char>(x));
+        break;
+      }
+    }
+    return v;
+  };
+  auto equivalent = [](const std::vector<any> &lhs,
+                       const std::vector<any> &rhs) {
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                      [](const any &a, const any &b) {
+                        return !(a < b) && !(b < a);
+                      });
+  };
+  {
+    auto v = make_values(1000);
+    auto expected = v;
+    std::sort(expected.begin(), expected.end());
+    awt::sort(v.begin(), v.end());
+    EXPECT_TRUE(equivalent(expected, v));
+  }
+  {
+    auto v = make_values(50000);
+    auto expected = v;
+    std::sort(expected.begin(), expected.end());
+    awt::parallel_sort(v.begin(), v.end(), 16);
+    EXPECT_TRUE(equivalent(expected, v));
+  }
+  {
+    std::vector<any> v;
+    awt::sort(v.begin(), v.end());
+    v.emplace_back(3);
+    awt::parallel_sort(v.begin(), v.end());
+    EXPECT_EQ(3, awt::any_cast<int>(v[0]));
+  }
+  {
+    // trivially copyable without a default constructor
+    struct point {
+      explicit point(int x) : x(x) {}
+      bool operator<(const point &other) const { return x < other.x; }
+      int x;
+    };
+    std::vector<any> v;
+    for (int x : {5, 1, 4, 2, 3})
+      v.emplace_back(point(x));
+    awt::sort(v.begin(), v.end());
+    for (int i = 0; i < 5; ++i)
+      EXPECT_EQ(i + 1, awt::any_cast<point>(v[i]).x);
+  }
+}
+
+TEST(any_flat_hash, all) {
+  using any = awt::any<any_trait::hashable, any_trait::comparable,
+                       any_trait::movable, any_trait::copiable>;
+  {
+    awt::any_flat_hash_set<any> s;
+    EXPECT_TRUE(s.empty());
+    EXPECT_TRUE(s.find(5) == s.end());
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_TRUE(s.insert(any(i)).second);
+      EXPECT_TRUE(s.insert(std::to_string(i)).second);
+    }
+    EXPECT_FALSE(s.insert(any(17)).second);
+    EXPECT_FALSE(s.insert(std::string("17")).second);
+    EXPECT_TRUE(s.insert(any()).second);
+    EXPECT_FALSE(s.insert(any()).second);
+    EXPECT_EQ(2001u, s.size());
+    EXPECT_TRUE(s.contains(any()));
+    EXPECT_TRUE(s.contains(999));
+    EXPECT_TRUE(s.contains(any(std::string("999"))));
+    EXPECT_FALSE(s.contains(1000));
+    EXPECT_FALSE(s.contains(999.0)); // same hash of value, different type
+    EXPECT_EQ(999, awt::any_cast<int>(*s.find(999)));
+
+    for (int i = 0; i < 1000; i += 2)
+      EXPECT_EQ(1u, s.erase(i));
+    EXPECT_EQ(0u, s.erase(0));
+    EXPECT_EQ(1501u, s.size());
+    EXPECT_FALSE(s.contains(10));
+    EXPECT_TRUE(s.contains(11));
+    EXPECT_EQ(1501, std::distance(s.begin(), s.end()));
+
+    auto copy = s;
+    s.clear();
+    EXPECT_TRUE(s.empty());
+    EXPECT_TRUE(s.begin() == s.end());
+    EXPECT_EQ(1501u, copy.size());
+    EXPECT_TRUE(copy.contains(std::string("10")));
+    s = std::move(copy);
+    EXPECT_TRUE(s.contains(std::string("10")));
+  }
+  {
+    awt::any_flat_hash_map<any, int> m;
+    m[1] = 10;
+    m[std::string("1")] = 20;
+    m[any(2.5)] = 30;
+    EXPECT_EQ(3u, m.size());
+    EXPECT_EQ(10, m.at(1));
+    EXPECT_EQ(20, m.at(any(std::string("1"))));
+    EXPECT_EQ(30, m[2.5]);
+    EXPECT_THROW(m.at(2), std::out_of_range);
+    EXPECT_FALSE(m.try_emplace(1, 100).second);
+    EXPECT_TRUE(m.try_emplace(2, 100).second);
+    m.insert_or_assign(2, 200);
+    EXPECT_EQ(200, m.at(2));
+    int sum = 0;
+    for (auto &p : m)
+      sum += p.second;
+    EXPECT_EQ(260, sum);
+  }
+}
+
+TEST(any_flat_map, all) {
+  using any =
+      awt::any<any_trait::orderable, any_trait::movable, any_trait::copiable>;
+  std::vector<any> keys;
+  std::vector<int> values;
+  for (int i = 0; i < 300; ++i) {
+    auto x = (i * 7919) % 100; // every key appears three times
+    keys.emplace_back(x);
+    keys.emplace_back(std::to_string(x));
+    keys.emplace_back(x * 0.5);
+    values.insert(values.end(), {i, i, i});
+  }
+  keys.emplace_back();
+  values.push_back(-1);
+
+  awt::any_flat_map<any, int> m(keys, values);
+  EXPECT_EQ(301u, m.size());
+  EXPECT_TRUE(std::is_sorted(m.keys().begin(), m.keys().end()));
+  EXPECT_EQ(-1, m.at(any()));
+  EXPECT_EQ(0, m.at(0));
+  EXPECT_EQ(1, m.at(std::string("19"))); // first value is kept
+  EXPECT_EQ(1, m.at(any(9.5)));
+  EXPECT_EQ(nullptr, m.find(100));
+  EXPECT_EQ(nullptr, m.find(any(100)));
+  EXPECT_EQ(nullptr, m.find(0.25));
+  EXPECT_FALSE(m.contains('a'));
+  EXPECT_THROW(m.at(std::string("100")), std::out_of_range);
+  for (int x = 0; x < 100; ++x) {
+    ASSERT_NE(nullptr, m.find(x));
+    EXPECT_EQ(*m.find(x), *m.find(any(x)));
+  }
+
+  *m.find(5) = 500;
+  EXPECT_EQ(500, m.at(any(5)));
+  EXPECT_FALSE(m.insert(5, 0));
+  EXPECT_TRUE(m.insert('a', 1));
+  EXPECT_TRUE(m.insert(std::string("050"), 2));
+  EXPECT_TRUE(m.insert(-1, 3));
+  EXPECT_EQ(304u, m.size());
+  EXPECT_TRUE(std::is_sorted(m.keys().begin(), m.keys().end()));
+  EXPECT_EQ(1, m.at('a'));
+  EXPECT_EQ(2, m.at(std::string("050")));
+  EXPECT_EQ(3, m.at(-1));
+
+  EXPECT_EQ(1u, m.erase(any()));
+  EXPECT_EQ(1u, m.erase(std::string("50")));
+  EXPECT_EQ(0u, m.erase(std::string("50")));
+  EXPECT_EQ(302u, m.size());
+  EXPECT_FALSE(m.contains(any()));
+  EXPECT_TRUE(m.contains(std::string("050")));
+  EXPECT_TRUE(std::is_sorted(m.keys().begin(), m.keys().end()));
+
+  awt::any_flat_map<any, std::string> small{{2, "b"}, {1, "a"}, {0.5, "c"}};
+  EXPECT_EQ("a", small.at(1));
+  EXPECT_EQ("c", small.at(0.5));
+
+  // ranges of many types are searched by type order
+  awt::any_flat_map<any, int> types{{1, 0},  {1L, 1},  {1u, 2}, {short(1), 3},
+                                    {1.f, 4}, {'1', 5}, {1ull, 6}};
+  EXPECT_EQ(7u, types.size());
+  for (std::size_t i = 0; i < types.size(); ++i)
+    EXPECT_EQ(&types.values()[i], types.find(types.keys()[i]));
+  EXPECT_EQ(3, types.at(short(1)));
+  EXPECT_EQ(6, types.at(any(1ull)));
+  EXPECT_FALSE(types.contains(1.0));
+  EXPECT_TRUE(types.insert(1.0, 7));
+  EXPECT_EQ(7, types.at(1.0));
+  EXPECT_TRUE(std::is_sorted(types.keys().begin(), types.keys().end()));
+}
+
+TEST(task_queue, all) {
+  {
+    awt::task_queue q(5);
+    EXPECT_EQ(8u, q.capacity());
+    EXPECT_TRUE(q.empty());
+    std::vector<int> order;
+    for (int i = 0; i < 4; ++i) {
+      auto ptr = std::make_unique<int>(i); // move only, not trivially copyable
+      EXPECT_TRUE(q.try_emplace(
+          [&order, ptr = std::move(ptr)] { order.push_back(*ptr); }));
+    }
+    auto shared = std::make_shared<int>(0);
+    for (int i = 0; i < 4; ++i)
+      EXPECT_TRUE(q.try_emplace([shared] {}));
+    EXPECT_FALSE(q.try_emplace([] {}));
+    awt::task_queue::task_type task = [] {};
+    EXPECT_FALSE(q.try_push(std::move(task)));
+    EXPECT_TRUE(task.has_value());
+    EXPECT_EQ(5, shared.use_count());
+    for (int i = 0; i < 5; ++i) {
+      ASSERT_TRUE(q.try_pop(task));
+      task();
+    }
+    task.reset();
+    EXPECT_EQ(4, shared.use_count());
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3}), order);
+    // the rest is destroyed with the queue
+  }
+  {
+    // trivially copyable callables are relocated by copying
+    awt::task_queue q(16);
+    int sum = 0;
+    for (int i = 0; i < 10; ++i)
+      q.try_emplace([&sum, i] { sum += i; });
+    awt::task_queue::task_type task;
+    while (q.try_pop(task))
+      task();
+    EXPECT_EQ(45, sum);
+    EXPECT_FALSE(q.try_pop(task));
+  }
+  {
+    awt::task_queue q(64);
+    std::atomic<long> sum{0};
+    constexpr int producers = 4, per_producer = 10000;
+    std::atomic<int> consumed{0};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+      threads.emplace_back([&, p] {
+        for (int i = 0; i < per_producer; ++i) {
+          long value = p * per_producer + i;
+          while (!q.try_emplace([&sum, value] { sum += value; }))
+            std::this_thread::yield();
+        }
+      });
+    for (int c = 0; c < 4; ++c)
+      threads.emplace_back([&] {
+        awt::task_queue::task_type task;
+        while (consumed < producers * per_producer) {
+          if (q.try_pop(task)) {
+            task();
+            ++consumed;
+          } else
+            std::this_thread::yield();
+        }
+      });
+    for (auto &thread : threads)
+      thread.join();
+    long n = producers * per_producer;
+    EXPECT_EQ(n * (n - 1) / 2, sum.load());
+  }
+}
+
+TEST(thread_pool, all) {
+  {
+    awt::thread_pool pool(4);
+    EXPECT_EQ(4u, pool.size());
+    auto answer = pool.submit([] { return 42; });
+    auto ptr = std::make_unique<int>(5);
+    auto moved = pool.submit([ptr = std::move(ptr)] { return *ptr; });
+    auto error = pool.submit([]() -> int { throw std::runtime_error("task"); });
+    auto nothing = pool.submit([] {});
+    EXPECT_EQ(42, answer.get());
+    EXPECT_FALSE(answer.valid());
+    EXPECT_EQ(5, moved.get());
+    EXPECT_THROW(error.get(), std::runtime_error);
+    nothing.get();
+
+    std::atomic<int> count{0};
+    for (int i = 0; i < 10000; ++i)
+      pool.post([&count] { ++count; });
+    std::vector<int> squares(10000);
+    pool.parallel_for(0, squares.size(),
+                      [&](std::size_t i) { squares[i] = int(i * i); });
+    for (std::size_t i = 0; i < squares.size(); ++i)
+      ASSERT_EQ(int(i * i), squares[i]);
+    EXPECT_THROW(pool.parallel_for(0, 100,
+                                   [](std::size_t i) {
+                                     if (i == 50)
+                                       throw std::logic_error("50");
+                                   }),
+                 std::logic_error);
+    // tasks posted before are finished by the destructor at the latest
+    pool.submit([] {}).get();
+    while (count < 10000)
+      std::this_thread::yield();
+  }
+  {
+    // waiting inside a task runs other tasks, even with a single worker
+    awt::thread_pool pool(1);
+    std::function<long(int)> fib = [&](int n) -> long {
+      if (n < 2)
+        return n;
+      auto lhs = pool.submit([&fib, n] { return fib(n - 1); });
+      auto rhs = fib(n - 2);
+      return lhs.get() + rhs;
+    };
+    EXPECT_EQ(610, pool.submit([&] { return fib(15); }).get());
+  }
+  {
+    awt::promise<int> p;
+    auto f = p.get_future();
+    EXPECT_THROW(p.get_future(), std::future_error);
+    EXPECT_FALSE(f.is_ready());
+    p.set_value(3);
+    EXPECT_TRUE(f.is_ready());
+    EXPECT_THROW(p.set_value(4), std::future_error);
+    EXPECT_EQ(3, f.get());
+    awt::future<void> broken;
+    {
+      awt::promise<void> abandoned;
+      broken = abandoned.get_future();
+    }
+    EXPECT_THROW(broken.get(), std::future_error);
+  }
+}
+
+TEST(future, then) {
+  {
+    awt::promise<int> p;
+    auto f = p.get_future()
+                 .then([](int x) { return x * 2; })
+                 .then([](int x) { return std::to_string(x); })
+                 .then([](std::string s) { return s + "!"; });
+    EXPECT_FALSE(f.is_ready());
+    p.set_value(21);
+    EXPECT_TRUE(f.is_ready()); // continuations ran inline
+    EXPECT_EQ("42!", f.get());
+  }
+  {
+    // attached to a ready future runs immediately, move only values pass
+    awt::promise<std::unique_ptr<int>> p;
+    auto f = p.get_future();
+    p.set_value(std::make_unique<int>(5));
+    int seen = 0;
+    auto g = f.then([&](std::unique_ptr<int> ptr) { seen = *ptr; });
+    EXPECT_EQ(5, seen);
+    g.get();
+  }
+  {
+    // exceptions skip continuations
+    awt::promise<void> p;
+    bool called = false;
+    auto f = p.get_future()
+                 .then([]() -> int { throw std::runtime_error("first"); })
+                 .then([&](int) { called = true; });
+    p.set_value();
+    EXPECT_THROW(f.get(), std::runtime_error);
+    EXPECT_FALSE(called);
+    awt::future<int> broken;
+    {
+      awt::promise<int> abandoned;
+      broken = abandoned.get_future().then([](int x) { return x; });
+    }
+    EXPECT_THROW(broken.get(), std::future_error);
+  }
+  {
+    awt::thread_pool pool(2);
+    awt::promise<int> p;
+    auto caller = std::this_thread::get_id();
+    auto f = p.get_future().then(pool, [caller](int x) {
+      EXPECT_NE(caller, std::this_thread::get_id());
+      return x + 1;
+    });
+    p.set_value(1);
+    EXPECT_EQ(2, f.get());
+    auto chained =
+        pool.submit([] { return 10; }).then(pool, [](int x) { return x * x; });
+    EXPECT_EQ(100, chained.get());
+  }
+}
+
+TEST(atomic_shared_any, all) {
+  using atomic = awt::atomic_shared_any<any_trait::copiable, any_trait::movable>;
+  {
+    atomic config;
+    EXPECT_FALSE(config.load());
+    EXPECT_FALSE(config.load_shared());
+    config.store(5);
+    EXPECT_EQ(5, awt::any_cast<int>(*config.load()));
+    auto counter = std::make_shared<int>(0);
+    config.store(counter);
+    EXPECT_EQ(2, counter.use_count());
+    {
+      auto guard = config.load();
+      auto handle = config.load_shared();
+      config.store(std::string("next"));
+      atomic::reclaim();
+      // old value is still in use
+      EXPECT_EQ(2, counter.use_count());
+      EXPECT_EQ(counter,
+                awt::any_cast<std::shared_ptr<int>>(*guard));
+      EXPECT_TRUE(handle->type() == typeid(std::shared_ptr<int>));
+    }
+    atomic::reclaim();
+    EXPECT_EQ(1, counter.use_count());
+    EXPECT_EQ("next", awt::any_cast<std::string>(*config.load_shared()));
+
+    atomic other(1.5);
+    config.store(other.load_shared());
+    EXPECT_EQ(1.5, awt::any_cast<double>(*config.load()));
+    config.reset();
+    EXPECT_FALSE(config.load());
+  }
+  {
+    auto counter = std::make_shared<int>(0);
+    atomic config(counter);
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    std::atomic<long> reads{0};
+    for (int i = 0; i < 4; ++i)
+      readers.emplace_back([&] {
+        while (!stop) {
+          if (reads % 2) {
+            auto guard = config.load();
+            EXPECT_TRUE(awt::any_cast<std::shared_ptr<int>>(&*guard));
+          } else {
+            auto handle = config.load_shared();
+            EXPECT_TRUE(awt::any_cast<std::shared_ptr<int>>(&*handle));
+          }
+          ++reads;
+        }
+      });
+    for (int i = 0; i < 2000; ++i)
+      config.store(counter);
+    stop = true;
+    for (auto &reader : readers)
+      reader.join();
+    config.reset();
+    atomic::reclaim();
+    EXPECT_EQ(1, counter.use_count());
+  }
+}
+
+TEST(signal, all) {
+  awt::signal<void(int)> s;
+  EXPECT_TRUE(s.empty());
+  s(1);
+  std::vector<std::string> calls;
+  auto record = [&](const char *name) {
+    return [&calls, name](int x) {
+      calls.push_back(name + std::to_string(x));
+    };
+  };
+  auto a = s.connect(record("a"));
+  auto b = s.connect(std::function<void(int)>(
+      [&](int x) { calls.push_back("b" + std::to_string(x)); }));
+  auto c = s.connect(record("c"));
+  EXPECT_EQ(3u, s.size());
+  s(1);
+  // slots of the same type are called together
+  EXPECT_EQ((std::vector<std::string>{"a1", "c1", "b1"}), calls);
+
+  calls.clear();
+  b.disconnect();
+  EXPECT_FALSE(b.connected());
+  EXPECT_TRUE(a.connected());
+  s(2);
+  EXPECT_EQ((std::vector<std::string>{"a2", "c2"}), calls);
+
+  // changes during emission
+  calls.clear();
+  awt::connection d, e, self;
+  self = s.connect([&](int x) {
+    c.disconnect();
+    e.disconnect();
+    self.disconnect();
+    d = s.connect(record("d"));
+    calls.push_back("self" + std::to_string(x));
+  });
+  e = s.connect(std::function<void(int)>(record("e")));
+  s(3);
+  EXPECT_EQ((std::vector<std::string>{"a3", "c3", "self3"}), calls);
+  EXPECT_TRUE(d.connected());
+  EXPECT_FALSE(c.connected());
+  EXPECT_FALSE(e.connected());
+  calls.clear();
+  s(4);
+  EXPECT_EQ((std::vector<std::string>{"a4", "d4"}), calls);
+  EXPECT_EQ(2u, s.size());
+
+  // nested emission
+  calls.clear();
+  bool nested = false;
+  auto recursive = s.connect(std::function<void(int)>([&](int x) {
+    if (!nested) {
+      nested = true;
+      s(x + 1);
+    }
+  }));
+  s(5);
+  EXPECT_EQ((std::vector<std::string>{"a5", "d5", "a6", "d6"}), calls);
+  recursive.disconnect();
+
+  calls.clear();
+  s.connect([](int x) {
+    if (x == 7)
+      throw std::runtime_error("slot");
+  });
+  EXPECT_THROW(s(7), std::runtime_error);
+  s.disconnect_all();
+  EXPECT_TRUE(s.empty());
+  EXPECT_FALSE(a.connected());
+  s(8);
+
+  {
+    awt::signal<void()> temporary;
+    d = temporary.connect([] {});
+  }
+  EXPECT_FALSE(d.connected());
+  d.disconnect();
+
+  std::vector<int> counters(100);
+  awt::signal<void(int)> many;
+  for (auto &counter : counters)
+    many.connect([&counter](int x) { counter += x; });
+  many(2);
+  EXPECT_TRUE(std::all_of(counters.begin(), counters.end(),
+                          [](int c) { return c == 2; }));
+}
+
+TEST(dispatcher, all) {
+  using message = awt::any<any_trait::copiable, any_trait::movable>;
+  awt::dispatcher<any_trait::copiable, any_trait::movable> d;
+  message m = 5;
+  EXPECT_FALSE(d.dispatch(m));
+
+  int ints = 0;
+  std::string text;
+  int other = 0;
+  d.on<int>([&](int &x) {
+    ints += x;
+    x = 0;
+  });
+  d.on<std::string>([&](const std::string &s) { text += s; });
+  d.otherwise([&](message &) { ++other; });
+  EXPECT_EQ(2u, d.size());
+  EXPECT_TRUE(d.handles<int>());
+  EXPECT_FALSE(d.handles<double>());
+
+  EXPECT_TRUE(d.dispatch(m));
+  EXPECT_EQ(5, ints);
+  EXPECT_EQ(0, awt::any_cast<int>(m));
+  message s = std::string("abc");
+  EXPECT_TRUE(d(s));
+  EXPECT_EQ("abc", text);
+  message unknown = 1.5;
+  EXPECT_FALSE(d.dispatch(unknown));
+  message empty;
+  EXPECT_FALSE(d.dispatch(empty));
+  EXPECT_EQ(2, other);
+
+  d.on<int>([&](int &x) { ints -= x; });
+  EXPECT_EQ(2u, d.size());
+  m = 3;
+  d.dispatch(m);
+  EXPECT_EQ(2, ints);
+
+  // enough types to need a larger table
+  std::vector<int> seen;
+  d.on<char>([&](char) { seen.push_back(0); });
+  d.on<long>([&](long) { seen.push_back(1); });
+  d.on<short>([&](short) { seen.push_back(2); });
+  d.on<float>([&](float) { seen.push_back(3); });
+  d.on<double>([&](double) { seen.push_back(4); });
+  d.on<std::vector<int>>([&](std::vector<int> &) { seen.push_back(5); });
+  std::vector<message> messages{'a', 1L, short(1), 1.f, 1.,
+                                std::vector<int>(3)};
+  for (auto &m : messages)
+    EXPECT_TRUE(d.dispatch(m));
+  EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 4, 5}), seen);
+  EXPECT_EQ(2, other);
+
+  // copies sharing the value are not modified through the handler
+  awt::dispatcher<any_trait::shared_storage, any_trait::copiable,
+                  any_trait::movable>
+      shared;
+  shared.on<std::vector<int>>([](std::vector<int> &v) { v.push_back(1); });
+  awt::normal_shared_any original = std::vector<int>(10);
+  auto copy = original;
+  shared.dispatch(copy);
+  EXPECT_EQ(10u, awt::any_cast<std::vector<int>>(original).size());
+  EXPECT_EQ(11u, awt::any_cast<std::vector<int>>(copy).size());
+}
+
+TEST(any, visit) {
+  using value = awt::normal_shared_any;
+  auto describe = awt::overload(
+      [](int x) { return "int " + std::to_string(x); },
+      [](const std::string &s) { return "string " + s; },
+      [](const value &v) {
+        return v.has_value() ? std::string("other") : std::string("empty");
+      });
+  const value i = 5, s = std::string("abc"), d = 1.5, empty;
+  EXPECT_EQ("int 5", (awt::visit<int, std::string>(describe, i)));
+  EXPECT_EQ("string abc", (awt::visit<int, std::string>(describe, s)));
+  EXPECT_EQ("other", (awt::visit<int, std::string>(describe, d)));
+  EXPECT_EQ("empty", (awt::visit<int, std::string>(describe, empty)));
+
+  // modification doesn't affect copies sharing the value
+  value v = std::string("abc");
+  auto copy = v;
+  awt::visit<int, std::string>(
+      awt::overload([](int &x) { ++x; }, [](std::string &s) { s += "d"; },
+                    [](value &) {}),
+      v);
+  EXPECT_EQ("abcd", awt::any_cast<std::string>(v));
+  EXPECT_EQ("abc", awt::any_cast<std::string>(copy));
+
+  // enough candidates to need a larger table
+  auto index = [](auto &x) -> int { return sizeof(x); };
+  awt::any<> c('a');
+  EXPECT_EQ(1, (awt::visit<short, long, float, double, char, int, unsigned,
+                           long long, std::string>(
+                   awt::overload(index, [](awt::any<> &) { return -1; }),
+                   c)));
+  c = std::vector<int>();
+  EXPECT_EQ(-1, (awt::visit<short, long, float, double, char, int, unsigned,
+                            long long, std::string>(
+                    awt::overload(index, [](awt::any<> &) { return -1; }),
+                    c)));
+}
+
+TEST(any_of, all) {
+  using value = awt::any_of<awt::type_list<int, double, std::string>,
+                            any_trait::copiable, any_trait::movable,
+                            any_trait::comparable, any_trait::hashable,
+                            any_trait::ostreamable>;
+  value v;
+  EXPECT_FALSE(v.has_value());
+  EXPECT_THROW(awt::visit([](const auto &) {}, v), std::bad_cast);
+  v = 5;
+  EXPECT_EQ(0u, v.index());
+  EXPECT_TRUE(v.holds<int>());
+  EXPECT_EQ(typeid(int), v.type());
+  EXPECT_EQ(5, awt::any_cast<int>(v));
+  EXPECT_EQ(nullptr, awt::any_cast<double>(&v));
+  EXPECT_THROW(awt::any_cast<std::string>(v), std::bad_cast);
+  // v = 'a'; fails to compile, char is not in the list
+
+  v = std::string("abc");
+  EXPECT_EQ(2u, v.index());
+  value copy = v;
+  EXPECT_EQ(v, copy);
+  EXPECT_EQ(std::hash<value>()(v), std::hash<value>()(copy));
+  EXPECT_NE(v, value(1.5));
+  std::stringstream ss;
+  ss << copy;
+  EXPECT_EQ("abc", ss.str());
+
+  auto size = [](const auto &x) -> std::size_t { return sizeof(x); };
+  EXPECT_EQ(sizeof(double), awt::visit(size, value(1.5)));
+  awt::visit([](auto &x) { x = std::decay_t<decltype(x)>(); }, copy);
+  EXPECT_EQ("", awt::any_cast<std::string>(copy));
+
+  value moved = std::move(v);
+  EXPECT_FALSE(v.has_value());
+  EXPECT_EQ("abc", awt::any_cast<std::string>(moved));
+  moved.reset();
+  EXPECT_TRUE(moved.empty());
+  EXPECT_EQ(value(), moved);
+
+  awt::any_of<awt::type_list<int, std::vector<int>>, any_trait::movable> w;
+  w.emplace<std::vector<int>>(3, 7);
+  EXPECT_EQ(3u, awt::any_cast<std::vector<int>>(w).size());
+
+  awt::any_of<awt::type_list<c1>, any_trait::has_example_function> f(c1{});
+  EXPECT_EQ(10, f.example_function(3, 7));
+  f.reset();
+  EXPECT_THROW(f.example_function(3, 7), std::bad_function_call);
+}
+
+#ifdef AWT_ENABLE_COROUTINES
+namespace {
+// completes immediately
+struct ready_value {
+  int value;
+  bool await_ready() const { return true; }
+  void await_suspend(std::coroutine_handle<>) const {}
+  int await_resume() const { return value; }
+};
+
+// decides in await_suspend not to suspend after all
+struct bool_suspend {
+  int value;
+  bool await_ready() const { return false; }
+  bool await_suspend(std::coroutine_handle<>) const { return false; }
+  int await_resume() const { return value * 2; }
+};
+
+awt::task<int> add(int a, int b) { co_return a + b; }
+
+awt::task<int> sum_awaitables(std::vector<awt::any_awaitable<int>> awaitables) {
+  int sum = 0;
+  for (auto &awaitable : awaitables)
+    sum += co_await awaitable;
+  co_return sum;
+}
+
+awt::task<> fail() {
+  throw std::runtime_error("coroutine");
+  co_return;
+}
+
+template <class Executor>
+awt::task<std::thread::id> thread_after_resume(Executor &executor) {
+  co_await awt::resume_on<Executor>(executor);
+  co_return std::this_thread::get_id();
+}
+} // namespace
+
+TEST(coroutine, all) {
+  {
+    std::vector<awt::any_awaitable<int>> awaitables;
+    awaitables.emplace_back(ready_value{1});
+    awaitables.emplace_back(bool_suspend{2});
+    awaitables.emplace_back(add(3, 4)); // handle returning await_suspend
+    EXPECT_EQ(12, awt::sync_wait(sum_awaitables(std::move(awaitables))));
+  }
+  EXPECT_THROW(awt::sync_wait(fail()), std::runtime_error);
+  {
+    awt::thread_pool pool(2);
+    EXPECT_NE(std::this_thread::get_id(),
+              awt::sync_wait(thread_after_resume(pool)));
+  }
+  {
+    awt::frame_arena arena(256);
+    {
+      awt::frame_arena::scope scope(arena);
+      auto first = add(1, 2);
+      auto second = add(3, 4);
+      EXPECT_EQ(2u, arena.live_frames());
+      EXPECT_LT(0u, arena.bytes_used());
+      EXPECT_EQ(3, awt::sync_wait(std::move(first)));
+      EXPECT_EQ(7, awt::sync_wait(std::move(second)));
+    }
+    EXPECT_EQ(0u, arena.live_frames());
+    arena.reset();
+    EXPECT_EQ(0u, arena.bytes_used());
+  }
+}
+#endif
+
+#ifdef AWT_ENABLE_INSTRUMENTATION
+namespace instrumented {
+struct small_value {
+  int value;
+};
+struct large_value {
+  char data[64];
+};
+struct shared_value {
+  char data[64];
+};
+} // namespace instrumented
+
+TEST(any, instrumentation) {
+  using awt::instrumentation::snapshot;
+  EXPECT_TRUE(awt::instrumentation::enabled);
+  auto before = snapshot();
+  {
+    awt::normal_any a(instrumented::small_value{1});
+    awt::normal_any b(a);
+    awt::normal_any c(std::move(b));
+    awt::normal_any l(instrumented::large_value{});
+    awt::normal_any m(l);
+    awt::normal_shared_any s(instrumented::shared_value{});
+    awt::normal_shared_any t(s);
+    awt::any_cast<instrumented::shared_value>(t).data[0] = 'a';
+  }
+  std::thread([] {
+    awt::normal_any x(instrumented::small_value{2});
+  }).join();
+
+  auto after = snapshot();
+  auto small = after.by_type["instrumented::small_value"];
+  EXPECT_EQ(2u, small.small_constructions);
+  EXPECT_EQ(0u, small.heap_constructions);
+  EXPECT_EQ(1u, small.clones);
+  EXPECT_EQ(1u, small.moves);
+  EXPECT_EQ(3u, small.destructions);
+  EXPECT_EQ(0u, small.heap_bytes);
+
+  auto large = after.by_type["instrumented::large_value"];
+  EXPECT_EQ(1u, large.heap_constructions);
+  EXPECT_EQ(1u, large.clones);
+  EXPECT_EQ(2u, large.destructions);
+  EXPECT_EQ(2 * sizeof(instrumented::large_value), large.heap_bytes);
+
+  // a copy shares the value, modification clones it
+  auto shared = after.by_type["instrumented::shared_value"];
+  EXPECT_EQ(1u, shared.heap_constructions);
+  EXPECT_EQ(2u, shared.clones);
+  EXPECT_EQ(3u, shared.destructions);
+  EXPECT_EQ(2 * (awt::detail::shared_block::header_size +
+                 sizeof(instrumented::shared_value)),
+            shared.heap_bytes);
+
+  EXPECT_EQ(before.total.small_constructions + 2,
+            after.total.small_constructions);
+
+  awt::any<any_trait::copiable, any_trait::comparable, any_trait::hashable> v(
+      1);
+  before = snapshot();
+  EXPECT_TRUE(v == v);
+  v.hash();
+  v.hash();
+  after = snapshot();
+  EXPECT_EQ(before.trait_calls["any_trait::comparable"] + 1,
+            after.trait_calls["any_trait::comparable"]);
+  EXPECT_EQ(before.trait_calls["any_trait::hashable"] + 2,
+            after.trait_calls["any_trait::hashable"]);
+}
+#endif